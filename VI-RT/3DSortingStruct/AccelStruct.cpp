@@ -1,3 +1,28 @@
 #include "AccelStruct.hpp"
 #include "scene.hpp"
+#include "AreaLight.hpp"
 
+void AccelStruct::setHitInfo (const Primitive *p, Intersection *isect) {
+    if (p->light_ndx >= 0) {
+        isect->isLight = true;
+        isect->Le = scene->lights[p->light_ndx]->L();
+        isect->light_ndx = p->light_ndx;
+        isect->f = nullptr;
+    }
+    else {
+        isect->isLight = false;
+        isect->f = scene->getMaterial(p->material_ndx);
+    }
+}
+
+void AccelStruct::traceRays (RayPacket8 &packet, IntersectionPacket8 &isects) {
+    for (int k = 0; k < packet.n; k++)
+        isects.hit[k] = trace(packet.rays[k], &isects.isect[k]);
+}
+
+std::vector<Primitive *> AccelStruct::getPrimitives (Scene *s) {
+    std::vector<Primitive *> prims = s->getPrims();
+    std::vector<Primitive *> lightPrims = s->getLightPrims();
+    prims.insert(prims.end(), lightPrims.begin(), lightPrims.end());
+    return prims;
+}
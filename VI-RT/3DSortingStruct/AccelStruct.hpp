@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <vector>
 #include "ray.hpp"
+#include "RayPacket.hpp"
 #include "intersection.hpp"
 #include "BB.hpp"
 #include "primitive.hpp"
@@ -23,13 +24,30 @@ class Scene;
 class AccelStruct {
 
 public:
-    AccelStruct () {}
-    ~AccelStruct () {}
+    AccelStruct (): verbose(true) {}
+    virtual ~AccelStruct () {}
     virtual void build (Scene *s) = 0;
-    virtual bool trace (Ray r, Intersection *isect) = 0;
+    virtual bool trace (const Ray &r, Intersection *isect) = 0;
+    // any hit query for shadow rays: is there a hit at a distance below tmax?
+    virtual bool occluded (const Ray &r, float tmax) = 0;
+    // closest hit of each ray of a packet, by default traced one by one
+    virtual void traceRays (RayPacket8 &packet, IntersectionPacket8 &isects);
+    // report traversal statistics gathered while rendering, if any
+    virtual void printStats () {}
+    // bring the structure up to date after the scene meshes moved their
+    // vertices; returns false if it was rebuilt (the default) instead of refitted
+    virtual bool refit () { build(scene); return false; }
+    // true if Instance primitives stay whole, traced through the shared BVH
+    // of their mesh; otherwise their triangles are copied in world space
+    virtual bool tracesInstances () const { return false; }
+    bool verbose;   // print build reports
 
 protected:
     Scene *scene;
+    // fill the material, or the emitted radiance for light sources, of a hit on p
+    void setHitInfo (const Primitive *p, Intersection *isect);
+    // the scene primitives followed by the geometry of its area lights
+    std::vector<Primitive *> getPrimitives (Scene *s);
 };
 
 #endif /* AccelStruct_hpp */
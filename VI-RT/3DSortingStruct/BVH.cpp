@@ -1,113 +1,386 @@
 #include "BVH.hpp"
 #include "scene.hpp"
 #include <stdio.h>
+#include <float.h>
+#include <stdlib.h>
+#include <chrono>
+#include "ThreadPool.hpp"
+
+// binned SAH parameters
+const int SAH_BINS = 16;
+const size_t MAX_LEAF_TRIANGLES = 20;
+// below this depth the builder falls back to median splits, which bounds the
+// tree depth (and thus the traversal stack) to MAX_SAH_DEPTH + log2(n)
+const int MAX_SAH_DEPTH = 32;
+// count the box and triangle tests done by trace() (reported by printStats())
+const bool BVH_TRACE_STATS = false;
+// subtrees over at least this many primitives / triangles are built as
+// separate tasks by the parallel builder
+const size_t PARALLEL_BUILD_CUTOFF = 1024;
+// LBVH: bits of each coordinate in the Morton codes, bits sorted per radix
+// sort pass, and high bits of the codes grouping the HLBVH treelets
+const int MORTON_BITS = 10;
+const int MORTON_RADIX_BITS = 10;
+const int HLBVH_CLUSTER_BITS = 12;
+
+static inline float axisValue(const Point &p, int axis)
+{
+    return (axis == 0) ? p.X : ((axis == 1) ? p.Y : p.Z);
+}
 
+template <typename Node>
+static int countNodes(Node *node)
+{
+    if (!node) return 0;
+    return 1 + countNodes(node->left) + countNodes(node->right);
+}
 
 void BVH::build(Scene* scene) {
     this->scene = scene;
-    auto prims = scene->getPrims();
-    if (type == 0)
-        root = buildBVH(prims, 0);
-    else
-        rootGeo = buildBVHGeo(prims, 0);
+    build(getPrimitives(scene));
 }
 
-bool BVH::traverseBVH(BVHNode* node, Ray& r, Intersection* isect) {
-    if (!node || !node->boundingBox.intersect(r)) return false;
+void BVH::build(std::vector<Primitive*> prims) {
+    int offset = 0;
+
+    // (re)start from an empty tree
+    free(nodes);
+    nodes = nullptr;
+    totalNodes = 0;
+    orderedPrims.clear();
+    orderedTriangles.clear();
+    trianglePrim.clear();
+    triangleOrder.clear();
+
+    // the triangle level builder works on the triangles of each primitive
+    // (its meshes, instances in world space and area lights), gathered up
+    // front so that the subtrees only touch their own range of the arrays
+    std::vector<BVHBuildPrim> buildPrims;
+    std::vector<BVHBuildTriangle> buildTriangles;
+    TriangleBuffer triangles;
+    if (type != 0)
+    {
+        std::vector<size_t> primFirst;
+        for (size_t i = 0; i < prims.size(); i++)
+        {
+            const size_t first = triangles.size();
+            if (triangles.add(prims[i]->g) == 0)
+                continue;
+            buildPrims.push_back({ prims[i], nullptr, triangles.size() - first });
+            primFirst.push_back(first);
+        }
+        buildTriangles.resize(triangles.size());
+        for (uint32_t t = 0; t < (uint32_t)triangles.size(); t++)
+            buildTriangles[t] = { triangles.bounds(t), triangles.centroid(t), t };
+        for (size_t p = 0; p < buildPrims.size(); p++)
+            buildPrims[p].triangles = &buildTriangles[primFirst[p]];
+    }
 
-    Intersection leftIsect, rightIsect, curr_isect;
+    ThreadPool *pool = nullptr;
+    if (nBuildThreads != 1)
+        pool = new ThreadPool(nBuildThreads);
+    buildPool = pool;
 
-    bool hitLeft = traverseBVH(node->left, r, &leftIsect);
-    if (hitLeft)
-        *isect = leftIsect;
+    // build a pointer based tree and flatten it into depth first order
+    auto start = std::chrono::steady_clock::now();
+    if (type == 0)
+    {
+        BVHNode *root = nullptr;
+        if (!prims.empty())
+            root = buildBVH(prims.data(), prims.size(), 0);
+        if (pool) pool->wait();
+        auto end = std::chrono::steady_clock::now();
+        buildTime = std::chrono::duration<double>(end - start).count();
+
+        orderedPrims.reserve(prims.size());
+        allocNodes(countNodes(root));
+        if (root)
+            flattenBVH(root, &offset);
+        deleteBVH(root);
+    }
+    else
+    {
+        BVHNodeGeo *root = nullptr;
+        if (!buildPrims.empty() && (splitMethod == SPLIT_LBVH || splitMethod == SPLIT_HLBVH))
+            root = buildLBVH(buildPrims.data(), buildPrims.size());
+        else if (!buildPrims.empty())
+            root = buildBVHGeo(buildPrims.data(), buildPrims.size(), 0);
+        if (pool) pool->wait();
+        auto end = std::chrono::steady_clock::now();
+        buildTime = std::chrono::duration<double>(end - start).count();
+
+        // the leaf triangles end up next to each other in depth first order
+        std::vector<uint32_t> order;
+        order.reserve(triangles.size());
+        allocNodes(countNodes(root));
+        if (root)
+            flattenBVHGeo(root, &offset, order);
+        deleteBVHGeo(root);
+        triangles.reorder(order);
+        orderedTriangles = std::move(triangles);
+        if (keepTriangleOrder)
+            triangleOrder = std::move(order);
+    }
+    buildPool = nullptr;
+    delete pool;
+
+    BVHCost c = cost();
+    builtCost = SAH_TRAVERSAL_COST * c.nodeVisits + SAH_INTERSECT_COST * c.itemTests;
+    if (!verbose)
+        return;
+    printf("BVH build (%s, %s): %.3lf secs\n", bvhSplitMethodName(splitMethod),
+           nBuildThreads == 1 ? "serial" : "parallel", buildTime);
+    printf("Flattened BVH: %d nodes (%.1lf KB), %lu %s (%.1lf KB)\n", totalNodes,
+           totalNodes * sizeof(LinearBVHNode) / 1024.,
+           type == 0 ? orderedPrims.size() : orderedTriangles.size(),
+           type == 0 ? "primitives" : "triangles",
+           type == 0 ? orderedPrims.size() * sizeof(Primitive *) / 1024.
+                     : (orderedTriangles.memory() + trianglePrim.size() * sizeof(Primitive *)) / 1024.);
+    if (type != 0 && !trianglePrim.empty())
+        printf("    %.1lf bytes per triangle (%.1lf in the nodes)\n",
+               (double)(orderedTriangles.memory() + trianglePrim.size() * sizeof(Primitive *)) / trianglePrim.size(),
+               (double)totalNodes * sizeof(LinearBVHNode) / trianglePrim.size());
+    printCost();
+}
 
-    bool hitRight = traverseBVH(node->right, r, &rightIsect);
+BVH::~BVH()
+{
+    free(nodes);
+}
 
-    if (hitRight &&  (!hitLeft || leftIsect.depth > rightIsect.depth))
-        *isect = rightIsect;
+void BVH::allocNodes(int n)
+{
+    void *mem = nullptr;
+    // nodes are 32 bytes wide and 32 bytes aligned: 2 per cache line
+    if (posix_memalign(&mem, 32, n * sizeof(LinearBVHNode)) != 0)
+        mem = nullptr;
+    nodes = (LinearBVHNode *)mem;
+    totalNodes = n;
+}
 
-    bool hitPrimitive = false;
-    if (node->primitive && node->primitive->g->intersect(r, &curr_isect)) {
-        hitPrimitive = true;
+int BVH::flattenBVH(BVHNode *node, int *offset)
+{
+    LinearBVHNode *linear = &nodes[*offset];
+    const int myOffset = (*offset)++;
 
-        (*isect) = curr_isect;
-        isect->f = this->scene->getMaterial(node->primitive->material_ndx);
+    linear->boundingBox = node->boundingBox;
+    if (node->primitive)
+    {
+        linear->itemsOffset = (int)orderedPrims.size();
+        linear->nItems = 1;
+        orderedPrims.push_back(node->primitive);
     }
-
-    return hitLeft || hitRight || hitPrimitive;
+    else
+    {
+        linear->axis = (uint8_t)node->axis;
+        linear->nItems = 0;
+        flattenBVH(node->left, offset);
+        linear->secondChildOffset = flattenBVH(node->right, offset);
+    }
+    return myOffset;
 }
 
-bool BVH::traverseBVHGeo(BVHNodeGeo* node, Ray& r, Intersection* isect) {
-    if (!node || !node->boundingBox.intersect(r)) return false;
-
-    Intersection leftIsect, rightIsect, curr_isect;
+int BVH::flattenBVHGeo(BVHNodeGeo *node, int *offset, std::vector<uint32_t> &order)
+{
+    LinearBVHNode *linear = &nodes[*offset];
+    const int myOffset = (*offset)++;
 
-    bool hitLeft = traverseBVHGeo(node->left, r, &leftIsect);
-    if (hitLeft)
-        *isect = leftIsect;
+    linear->boundingBox = node->boundingBox;
+    if (!node->left && !node->right)
+    {
+        linear->itemsOffset = (int)order.size();
+        linear->nItems = (uint16_t)node->triangles.size();
+        for (uint32_t t : node->triangles)
+        {
+            order.push_back(t);
+            trianglePrim.push_back(node->source->prim);
+        }
+    }
+    else
+    {
+        linear->axis = (uint8_t)node->axis;
+        linear->nItems = 0;
+        flattenBVHGeo(node->left, offset, order);
+        linear->secondChildOffset = flattenBVHGeo(node->right, offset, order);
+    }
+    return myOffset;
+}
 
-    bool hitRight = traverseBVHGeo(node->right, r, &rightIsect);
+bool BVH::refit()
+{
+    if (totalNodes == 0)
+        return true;
 
-    if (hitRight &&  (!hitLeft || leftIsect.depth > rightIsect.depth))
-        *isect = rightIsect;
+    if (type != 0)
+        orderedTriangles.updateVertices();
 
-    bool hitPrimitive = false;
-    for (auto prim_itr = node->triangles.begin(); prim_itr != node->triangles.end(); prim_itr++)
+    // children come after their parent in depth first order, so a backwards
+    // sweep updates both children of a node before the node itself
+    for (int n = totalNodes - 1; n >= 0; n--)
     {
-        if ((*prim_itr)->intersect(r, &curr_isect))
+        LinearBVHNode &node = nodes[n];
+        if (node.nItems > 0)
         {
-            if (!hitPrimitive)
-            { // first intersection
-                hitPrimitive = true;
-                *isect = curr_isect;
+            const int first = node.itemsOffset, last = node.itemsOffset + node.nItems;
+            if (type == 0)
+            {
+                node.boundingBox = orderedPrims[first]->g->bb;
+                for (int i = first + 1; i < last; i++)
+                    node.boundingBox.update(orderedPrims[i]->g->bb);
             }
-            else if (curr_isect.depth < isect->depth)
+            else
             {
-                *isect = curr_isect;
+                node.boundingBox = orderedTriangles.bounds(first);
+                for (int i = first + 1; i < last; i++)
+                    node.boundingBox.update(orderedTriangles.bounds(i));
             }
-            isect->f = this->scene->getMaterial(node->materialIndex);
+        }
+        else
+        {
+            node.boundingBox = nodes[n + 1].boundingBox;
+            node.boundingBox.update(nodes[node.secondChildOffset].boundingBox);
         }
     }
-    // if (node->geometry && node->geometry->intersect(r, &curr_isect)) {
-    //     hitPrimitive = true;
-
-    //     (*isect) = curr_isect;
-    //     isect->f = this->scene->getMaterial(node->materialIndex);
-    // }
 
-    return hitLeft || hitRight || hitPrimitive;
+    // moving geometry makes the boxes overlap more and more
+    BVHCost c = cost();
+    if (SAH_TRAVERSAL_COST * c.nodeVisits + SAH_INTERSECT_COST * c.itemTests > REFIT_REBUILD_RATIO * builtCost)
+    {
+        build(scene);
+        return false;
+    }
+    return true;
 }
 
-bool BVH::trace (Ray r, Intersection *isect) 
+// Iterative traversal over the flattened nodes, front to back: at each interior
+// node the child on the side the ray comes from is visited first, the other is
+// pushed on the stack. Boxes entered beyond the closest hit found so far are
+// culled, so once a near hit is found the far subtrees are skipped.
+bool BVH::trace (const Ray &r, Intersection *isect)
 {
-    if (type == 0)
-        return traverseBVH(this->root, r, isect);
-    else
-        return traverseBVHGeo(this->rootGeo, r, isect);
-}
+    if (totalNodes == 0) return false;
 
+    int toVisit[BVH_STACK_SIZE];
+    int toVisitOffset = 0, current = 0;
+    bool hit = false;
+    float tClosest = FLT_MAX;
+    long nodeTests = 0, itemTests = 0;
+    Intersection curr_isect;
+    TriangleHit triHit;     // type 1: the Intersection is filled after the traversal
 
-BVHNode *BVH::buildBVH(std::vector<Primitive *> &primitives, int depth)
-{
-    if (primitives.empty())
-        return nullptr;
-
-    BVHNode *node = new BVHNode();
-    node->boundingBox = primitives[0]->g->bb;
+    while (true)
+    {
+        const LinearBVHNode &node = nodes[current];
+        float tEnter;
+        nodeTests++;
+        if (node.boundingBox.intersect(r, tClosest, &tEnter))
+        {
+            if (node.nItems > 0)
+            { // leaf: intersect its items, keeping the closest hit
+                for (int i = node.itemsOffset; i < node.itemsOffset + node.nItems; i++)
+                {
+                    itemTests++;
+                    if (type != 0)
+                    {
+                        if (orderedTriangles.intersect(i, r, &triHit))
+                            tClosest = triHit.t;
+                    }
+                    else if (orderedPrims[i]->g->intersect(r, &curr_isect) && curr_isect.depth < tClosest)
+                    {
+                        hit = true;
+                        tClosest = curr_isect.depth;
+                        *isect = curr_isect;
+                        setHitInfo(orderedPrims[i], isect);
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+            else if (r.sign[node.axis])
+            { // ray goes towards -axis: the second child is the nearer one
+                toVisit[toVisitOffset++] = current + 1;
+                current = node.secondChildOffset;
+            }
+            else
+            {
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisitOffset == 0) break;
+            current = toVisit[--toVisitOffset];
+        }
+    }
 
-    for (const auto &prim : primitives)
+    if (BVH_TRACE_STATS)
     {
-        node->boundingBox.update(prim->g->bb);
+        statRays.fetch_add(1, std::memory_order_relaxed);
+        statNodeTests.fetch_add(nodeTests, std::memory_order_relaxed);
+        statItemTests.fetch_add(itemTests, std::memory_order_relaxed);
     }
+    if (triHit.triangle >= 0)
+    {
+        hit = true;
+        orderedTriangles.fillHit(triHit, r, isect);
+        setHitInfo(trianglePrim[triHit.triangle], isect);
+    }
+    return hit;
+}
 
-    if (primitives.size() == 1)
+// Any hit traversal for shadow rays: no ordering and no closest hit, the
+// first item hit closer than tmax ends the query. Light sources do not cast
+// shadows: the shadow ray would otherwise hit the light it was sampled on.
+bool BVH::occluded (const Ray &r, float tmax)
+{
+    if (totalNodes == 0) return false;
+
+    int toVisit[BVH_STACK_SIZE];
+    int toVisitOffset = 0, current = 0;
+    TriangleHit triHit(tmax);
+
+    while (true)
     {
-        node->primitive = primitives[0];
-        return node;
+        const LinearBVHNode &node = nodes[current];
+        float tEnter;
+        if (node.boundingBox.intersect(r, tmax, &tEnter))
+        {
+            if (node.nItems > 0)
+            {
+                for (int i = node.itemsOffset; i < node.itemsOffset + node.nItems; i++)
+                {
+                    bool hitItem;
+                    if (type == 0)
+                        hitItem = orderedPrims[i]->light_ndx < 0 && orderedPrims[i]->g->occluded(r, tmax);
+                    else
+                        hitItem = trianglePrim[i]->light_ndx < 0 && orderedTriangles.intersect(i, r, &triHit);
+                    if (hitItem)
+                        return true;
+                }
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+            else
+            {
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisitOffset == 0) break;
+            current = toVisit[--toVisitOffset];
+        }
     }
+    return false;
+}
 
-    // split in the middle of the biggest axis
-    Point min = node->boundingBox.min, max = node->boundingBox.max;
+// split in the middle of the biggest axis: sort by centroid, half goes to each side
+template <typename T, typename CentroidF>
+static size_t partitionMedian(T *items, size_t n, const BB &bounds, CentroidF itemCentroid, int *splitAxis)
+{
+    Point min = bounds.min, max = bounds.max;
 
     float xsize = fabsf(max.X - min.X);
     float ysize = fabsf(max.Y - min.Y);
@@ -121,151 +394,475 @@ BVHNode *BVH::buildBVH(std::vector<Primitive *> &primitives, int depth)
     else
         axis = 2; // Z axis is the largest
 
-    auto comparator = [axis](Primitive *a, Primitive *b)
+    auto comparator = [axis, itemCentroid](const T &a, const T &b)
     {
-        if (axis == 0)
-            return a->g->bb.center().X < b->g->bb.center().X;
-        else if (axis == 1)
-            return a->g->bb.center().Y < b->g->bb.center().Y;
-        return a->g->bb.center().Z < b->g->bb.center().Z;
+        return axisValue(itemCentroid(a), axis) < axisValue(itemCentroid(b), axis);
     };
-    std::sort(primitives.begin(), primitives.end(), comparator);
+    std::sort(items, items + n, comparator);
 
-    size_t mid = primitives.size() / 2;
-    std::vector<Primitive *> leftPrimitives(primitives.begin(), primitives.begin() + mid);
-    std::vector<Primitive *> rightPrimitives(primitives.begin() + mid, primitives.end());
+    *splitAxis = axis;
+    return n / 2;
+}
+
+// Binned SAH split, see pbrt book (3rd ed.), sec 4.3.2, evaluated on the 3 axes.
+// Partitions items[0..n[ in place and returns how many go to the left child,
+// or 0 if keeping all of them in a leaf is cheaper (only if n <= maxLeaf).
+// Each level is O(n), so the whole build is O(n log n).
+template <typename T, typename BoundsF, typename CentroidF>
+static size_t partitionSAH(T *items, size_t n, const BB &bounds, size_t maxLeaf,
+                           BoundsF itemBounds, CentroidF itemCentroid, int *splitAxis)
+{
+    BB cbounds;
+    cbounds.min = cbounds.max = itemCentroid(items[0]);
+    for (size_t i = 1; i < n; i++)
+        cbounds.update(itemCentroid(items[i]));
 
-    node->left = buildBVH(leftPrimitives, depth + 1);
-    node->right = buildBVH(rightPrimitives, depth + 1);
+    float bestCost = FLT_MAX;
+    int bestAxis = -1, bestBin = -1;
+    *splitAxis = 0;
 
-    return node;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float cmin = axisValue(cbounds.min, axis);
+        const float extent = axisValue(cbounds.max, axis) - cmin;
+        if (extent <= 0.f)
+            continue;
+
+        int count[SAH_BINS] = {0};
+        BB binBB[SAH_BINS];
+        for (size_t i = 0; i < n; i++)
+        {
+            int b = std::min(SAH_BINS - 1, (int)(SAH_BINS * (axisValue(itemCentroid(items[i]), axis) - cmin) / extent));
+            if (count[b]++ == 0)
+                binBB[b] = itemBounds(items[i]);
+            else
+                binBB[b].update(itemBounds(items[i]));
+        }
+
+        // sweep from the right: area and count above each candidate plane
+        float rightArea[SAH_BINS];
+        int rightCount[SAH_BINS];
+        BB acc;
+        int accCount = 0;
+        for (int b = SAH_BINS - 1; b > 0; b--)
+        {
+            if (count[b] > 0)
+            {
+                if (accCount == 0) acc = binBB[b];
+                else acc.update(binBB[b]);
+                accCount += count[b];
+            }
+            rightCount[b] = accCount;
+            rightArea[b] = accCount ? acc.area() : 0.f;
+        }
+
+        // then from the left, evaluating the plane after bin b
+        accCount = 0;
+        for (int b = 0; b < SAH_BINS - 1; b++)
+        {
+            if (count[b] > 0)
+            {
+                if (accCount == 0) acc = binBB[b];
+                else acc.update(binBB[b]);
+                accCount += count[b];
+            }
+            if (accCount == 0 || rightCount[b + 1] == 0)
+                continue;
+            const float cost = SAH_TRAVERSAL_COST + SAH_INTERSECT_COST *
+                (accCount * acc.area() + rightCount[b + 1] * rightArea[b + 1]) / bounds.area();
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    if (bestAxis < 0) // all centroids coincide, no plane separates them
+        return (n <= maxLeaf) ? 0 : n / 2;
+
+    if (n <= maxLeaf && n * SAH_INTERSECT_COST <= bestCost)
+        return 0;
+
+    *splitAxis = bestAxis;
+    const float cmin = axisValue(cbounds.min, bestAxis);
+    const float extent = axisValue(cbounds.max, bestAxis) - cmin;
+    T *mid = std::partition(items, items + n, [&](const T &it)
+    {
+        int b = std::min(SAH_BINS - 1, (int)(SAH_BINS * (axisValue(itemCentroid(it), bestAxis) - cmin) / extent));
+        return b <= bestBin;
+    });
+    return mid - items;
 }
 
-BVHNodeGeo *BVH::buildBVHGeoAux(std::vector<Triangle*>& triangles, int materialIndex, int depth) {
-    if (triangles.empty())
-        return nullptr;
+static BB primitiveBounds(Primitive *p) { return p->g->bb; }
+static Point primitiveCentroid(Primitive *p) { return p->g->bb.center(); }
+static BB triangleBounds(const BVHBuildTriangle &t) { return t.bb; }
+static Point triangleCentroid(const BVHBuildTriangle &t) { return t.centroid; }
+static BB buildPrimBounds(const BVHBuildPrim &p) { return p.prim->g->bb; }
+static Point buildPrimCentroid(const BVHBuildPrim &p) { return p.prim->g->bb.center(); }
 
-    BVHNodeGeo *node = new BVHNodeGeo();
-    node->boundingBox = triangles[0]->bb;
+void BVH::spawn(size_t n, std::function<void()> task)
+{
+    if (buildPool && n >= PARALLEL_BUILD_CUTOFF)
+        buildPool->submit(std::move(task));
+    else
+        task();
+}
 
-    for (const auto &tri : triangles)
+// The builders split items[0..n[ in place, so both halves are independent
+// ranges of the same array: the left one is spawned as a task (when large
+// enough), the right one is built by the calling thread.
+BVHNode *BVH::buildBVH(Primitive **primitives, size_t n, int depth)
+{
+    BVHNode *node = new BVHNode();
+    node->boundingBox = primitives[0]->g->bb;
+
+    for (size_t i = 1; i < n; i++)
     {
-        node->boundingBox.update(tri->bb);
+        node->boundingBox.update(primitives[i]->g->bb);
     }
 
-    if (triangles.size() <= 20)
+    if (n == 1)
     {
-        node->triangles = triangles;
-        // node->geometry = triangles[0];
-        node->materialIndex = materialIndex;
+        node->primitive = primitives[0];
         return node;
     }
 
-    // split in the middle of the biggest axis
-    Point min = node->boundingBox.min, max = node->boundingBox.max;
+    size_t mid;
+    if (splitMethod == SPLIT_SAH && depth < MAX_SAH_DEPTH)
+        mid = partitionSAH(primitives, n, node->boundingBox, 1, primitiveBounds, primitiveCentroid, &node->axis);
+    else
+        mid = partitionMedian(primitives, n, node->boundingBox, primitiveCentroid, &node->axis);
 
-    float xsize = fabsf(max.X - min.X);
-    float ysize = fabsf(max.Y - min.Y);
-    float zsize = fabsf(max.Z - min.Z);
+    spawn(mid, [=] { node->left = buildBVH(primitives, mid, depth + 1); });
+    node->right = buildBVH(primitives + mid, n - mid, depth + 1);
 
-    int axis = 0;
-    if (xsize >= ysize && xsize >= zsize)
-        axis = 0; // X axis is the largest
-    else if (ysize >= zsize)
-        axis = 1; // Y axis is the largest
-    else
-        axis = 2; // Z axis is the largest
+    return node;
+}
 
-    auto comparator = [axis](Triangle *a, Triangle *b)
+BVHNodeGeo *BVH::buildBVHGeoAux(BVHBuildTriangle *triangles, size_t n, const BVHBuildPrim *source, int depth) {
+    BVHNodeGeo *node = new BVHNodeGeo();
+    node->boundingBox = triangles[0].bb;
+
+    for (size_t i = 1; i < n; i++)
     {
-        if (axis == 0)
-            return a->middlePoint().X < b->middlePoint().X;
-        else if (axis == 1)
-            return a->middlePoint().Y < b->middlePoint().Y;
-        return a->middlePoint().Z < b->middlePoint().Z;
-    };
-    std::sort(triangles.begin(), triangles.end(), comparator);
+        node->boundingBox.update(triangles[i].bb);
+    }
 
-    size_t mid = triangles.size() / 2;
-    std::vector<Triangle *> leftTriangles(triangles.begin(), triangles.begin() + mid);
-    std::vector<Triangle *> rightTriangles(triangles.begin() + mid, triangles.end());
+    size_t mid = 0;
+    if (splitMethod == SPLIT_SAH && depth < MAX_SAH_DEPTH)
+        mid = partitionSAH(triangles, n, node->boundingBox, MAX_LEAF_TRIANGLES, triangleBounds, triangleCentroid, &node->axis);
+    else if (n > MAX_LEAF_TRIANGLES)
+        mid = partitionMedian(triangles, n, node->boundingBox, triangleCentroid, &node->axis);
 
-    node->left = buildBVHGeoAux(leftTriangles, materialIndex, depth + 1);
-    node->right = buildBVHGeoAux(rightTriangles, materialIndex, depth + 1);
+    if (mid == 0)
+    {
+        node->triangles.resize(n);
+        for (size_t i = 0; i < n; i++)
+            node->triangles[i] = triangles[i].index;
+        node->source = source;
+        return node;
+    }
+
+    spawn(mid, [=] { node->left = buildBVHGeoAux(triangles, mid, source, depth + 1); });
+    node->right = buildBVHGeoAux(triangles + mid, n - mid, source, depth + 1);
 
     return node;
 }
 
 
-BVHNodeGeo *BVH::buildBVHGeo(std::vector<Primitive*>& primitives, int depth) {
-    if (primitives.empty())
-        return nullptr;
+BVHNodeGeo *BVH::buildBVHGeo(BVHBuildPrim *primitives, size_t n, int depth) {
+    if (n == 1)
+    {
+        return buildBVHGeoAux(primitives[0].triangles, primitives[0].nTriangles, &primitives[0], depth + 1);
+    }
 
     BVHNodeGeo *node = new BVHNodeGeo();
-    node->boundingBox = primitives[0]->g->bb;
+    node->boundingBox = primitives[0].prim->g->bb;
 
-    for (const auto &prim : primitives)
+    for (size_t i = 1; i < n; i++)
     {
-        node->boundingBox.update(prim->g->bb);
+        node->boundingBox.update(primitives[i].prim->g->bb);
     }
 
-    if (primitives.size() == 1)
+    size_t mid;
+    if (splitMethod == SPLIT_SAH && depth < MAX_SAH_DEPTH)
+        mid = partitionSAH(primitives, n, node->boundingBox, 1, buildPrimBounds, buildPrimCentroid, &node->axis);
+    else
+        mid = partitionMedian(primitives, n, node->boundingBox, buildPrimCentroid, &node->axis);
+
+    // the task size is the number of triangles below the split
+    size_t leftTriangles = 0;
+    for (size_t i = 0; i < mid; i++)
+        leftTriangles += primitives[i].nTriangles;
+
+    spawn(leftTriangles, [=] { node->left = buildBVHGeo(primitives, mid, depth + 1); });
+    node->right = buildBVHGeo(primitives + mid, n - mid, depth + 1);
+
+    return node;
+}
+
+
+// Linear BVH (LBVH, see pbrt book (3rd ed.), sec 4.3.3): the triangles are
+// sorted along a Z-order curve by the Morton code of their centroid, then
+// every node splits its (sorted) range where the highest differing bit of
+// the codes changes, which is found by a binary search.
+
+// spread the 10 low bits of x so that there are 2 zero bits between each
+static inline uint32_t leftShift3(uint32_t x)
+{
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// 30 bit code of a point with coordinates in [0,1]: bit 3k+a is bit k of axis a
+static inline uint32_t mortonCode(float x, float y, float z)
+{
+    const float scale = (float)(1 << MORTON_BITS);
+    const uint32_t ix = (uint32_t)std::min(std::max(x * scale, 0.f), scale - 1.f);
+    const uint32_t iy = (uint32_t)std::min(std::max(y * scale, 0.f), scale - 1.f);
+    const uint32_t iz = (uint32_t)std::min(std::max(z * scale, 0.f), scale - 1.f);
+    return (leftShift3(iz) << 2) | (leftShift3(iy) << 1) | leftShift3(ix);
+}
+
+void BVH::parallelFor(int n, std::function<void(int)> task)
+{
+    if (!buildPool)
     {
-        if (dynamic_cast<Mesh*>(primitives[0]->g)) {
-            Mesh *mesh = (Mesh*)primitives[0]->g;
-            std::vector<Triangle*> triangles;
+        for (int i = 0; i < n; i++)
+            task(i);
+        return;
+    }
+    for (int i = 0; i < n; i++)
+        buildPool->submit([&task, i] { task(i); });
+    buildPool->wait();
+}
 
-            for (Face face : mesh->faces) {
-                Point v1 = mesh->vertices[face.vert_ndx[0]];
-                Point v2 = mesh->vertices[face.vert_ndx[1]];
-                Point v3 = mesh->vertices[face.vert_ndx[2]];
-                Triangle *tri = new Triangle(v1, v2, v3, face.geoNormal);
-                triangles.push_back(tri);
+// LSD radix sort of the codes, MORTON_RADIX_BITS per pass. Each pass counts
+// the digits of every chunk of the array, then scatters the chunks to the
+// offsets given by the prefix sum over (digit, chunk), which keeps it stable.
+void BVH::radixSort(std::vector<MortonPrim> &v)
+{
+    const int nBuckets = 1 << MORTON_RADIX_BITS;
+    const int nChunks = buildPool ? buildPool->size() : 1;
+    const size_t chunkSize = (v.size() + nChunks - 1) / nChunks;
+    std::vector<MortonPrim> tmp(v.size());
+    std::vector<size_t> offsets(nChunks * nBuckets);
+    MortonPrim *in = v.data(), *out = tmp.data();
+
+    for (int shift = 0; shift < 3 * MORTON_BITS; shift += MORTON_RADIX_BITS)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallelFor(nChunks, [&](int c)
+        {
+            size_t *count = &offsets[c * nBuckets];
+            const size_t end = std::min(v.size(), (c + 1) * chunkSize);
+            for (size_t i = c * chunkSize; i < end; i++)
+                count[(in[i].code >> shift) & (nBuckets - 1)]++;
+        });
+
+        size_t sum = 0;
+        for (int b = 0; b < nBuckets; b++)
+        {
+            for (int c = 0; c < nChunks; c++)
+            {
+                const size_t count = offsets[c * nBuckets + b];
+                offsets[c * nBuckets + b] = sum;
+                sum += count;
             }
+        }
+
+        parallelFor(nChunks, [&](int c)
+        {
+            size_t *offset = &offsets[c * nBuckets];
+            const size_t end = std::min(v.size(), (c + 1) * chunkSize);
+            for (size_t i = c * chunkSize; i < end; i++)
+                out[offset[(in[i].code >> shift) & (nBuckets - 1)]++] = in[i];
+        });
+        std::swap(in, out);
+    }
+    if (in != v.data())
+        v.swap(tmp);
+}
 
-            node = this->buildBVHGeoAux(triangles, primitives[0]->material_ndx ,depth+1);
+// Emit the node of a range of sorted triangles whose codes only differ in
+// bits [0, bitIndex]. Leaves hold the triangles of a single primitive. The
+// boxes are computed afterwards by fitBVHGeo().
+BVHNodeGeo *BVH::emitLBVH(const uint32_t *codes, const uint32_t *triangles, const BVHBuildPrim **prims, size_t n,
+                          int bitIndex)
+{
+    BVHNodeGeo *node = new BVHNodeGeo();
 
+    size_t mid = 0;
+    const uint32_t diff = (bitIndex < 0) ? 0 : (codes[0] ^ codes[n - 1]) & ((2u << bitIndex) - 1);
+    if (n > MAX_LEAF_TRIANGLES && diff != 0)
+    {
+        // split where the highest differing bit goes from 0 to 1
+        int bit = bitIndex;
+        while (!(diff & (1u << bit)))
+            bit--;
+        const uint32_t mask = 1u << bit;
+        size_t lo = 0, hi = n - 1;      // codes[lo] has the bit clear, codes[hi] set
+        while (hi - lo > 1)
+        {
+            const size_t m = (lo + hi) / 2;
+            if (codes[m] & mask) hi = m;
+            else lo = m;
         }
-        return node;
+        mid = hi;
+        node->axis = bit % 3;
+        bitIndex = bit - 1;
+    }
+    else
+    {
+        // a leaf, unless it mixes primitives or the codes cannot split it further
+        while (mid < n && prims[mid] == prims[0])
+            mid++;
+        if (mid == n)
+            mid = (n > MAX_LEAF_TRIANGLES) ? n / 2 : 0;
     }
 
-    // split in the middle of the biggest axis
-    Point min = node->boundingBox.min, max = node->boundingBox.max;
+    if (mid == 0)
+    {
+        node->triangles.assign(triangles, triangles + n);
+        node->source = prims[0];
+        return node;
+    }
 
-    float xsize = fabsf(max.X - min.X);
-    float ysize = fabsf(max.Y - min.Y);
-    float zsize = fabsf(max.Z - min.Z);
+    spawn(mid, [=] { node->left = emitLBVH(codes, triangles, prims, mid, bitIndex); });
+    node->right = emitLBVH(codes + mid, triangles + mid, prims + mid, n - mid, bitIndex);
 
-    int axis = 0;
-    if (xsize >= ysize && xsize >= zsize)
-        axis = 0; // X axis is the largest
-    else if (ysize >= zsize)
-        axis = 1; // Y axis is the largest
-    else
-        axis = 2; // Z axis is the largest
+    return node;
+}
 
-    auto comparator = [axis](Primitive *a, Primitive *b)
+// bottom up computation of the boxes of an emitted tree; the build item of
+// triangle t is items[t]
+static void fitBVHGeo(BVHNodeGeo *node, const BVHBuildTriangle *items)
+{
+    if (!node->left)
     {
-        if (axis == 0)
-            return a->g->bb.center().X < b->g->bb.center().X;
-        else if (axis == 1)
-            return a->g->bb.center().Y < b->g->bb.center().Y;
-        return a->g->bb.center().Z < b->g->bb.center().Z;
-    };
-    std::sort(primitives.begin(), primitives.end(), comparator);
+        node->boundingBox = items[node->triangles[0]].bb;
+        for (uint32_t t : node->triangles)
+            node->boundingBox.update(items[t].bb);
+        return;
+    }
+    fitBVHGeo(node->left, items);
+    fitBVHGeo(node->right, items);
+    node->boundingBox = node->left->boundingBox;
+    node->boundingBox.update(node->right->boundingBox);
+}
 
+static BB nodeBounds(BVHNodeGeo *node) { return node->boundingBox; }
+static Point nodeCentroid(BVHNodeGeo *node) { return node->boundingBox.center(); }
 
+// SAH tree over the treelets of HLBVH
+static BVHNodeGeo *buildTreelets(BVHNodeGeo **treelets, size_t n, int depth)
+{
+    if (n == 1)
+        return treelets[0];
 
-    size_t mid = primitives.size() / 2;
-    std::vector<Primitive *> leftPrimitives(primitives.begin(), primitives.begin() + mid);
-    std::vector<Primitive *> rightPrimitives(primitives.begin() + mid, primitives.end());
+    BVHNodeGeo *node = new BVHNodeGeo();
+    node->boundingBox = treelets[0]->boundingBox;
+    for (size_t i = 1; i < n; i++)
+        node->boundingBox.update(treelets[i]->boundingBox);
 
-    node->left = buildBVHGeo(leftPrimitives, depth + 1);
-    node->right = buildBVHGeo(rightPrimitives, depth + 1);
+    size_t mid;
+    if (depth < MAX_SAH_DEPTH)
+        mid = partitionSAH(treelets, n, node->boundingBox, 1, nodeBounds, nodeCentroid, &node->axis);
+    else
+        mid = partitionMedian(treelets, n, node->boundingBox, nodeCentroid, &node->axis);
 
+    node->left = buildTreelets(treelets, mid, depth + 1);
+    node->right = buildTreelets(treelets + mid, n - mid, depth + 1);
     return node;
 }
 
+// Triangle level LBVH over all the triangles of the scene. With SPLIT_HLBVH
+// the triangles are grouped by the high HLBVH_CLUSTER_BITS of their codes,
+// a LBVH is emitted for each group, and the top of the tree is rebuilt with
+// the SAH over those treelets (see pbrt book (3rd ed.), sec 4.3.3).
+BVHNodeGeo *BVH::buildLBVH(BVHBuildPrim *primitives, size_t nPrims)
+{
+    // the items of all the primitives are consecutive, in triangle order
+    const BVHBuildTriangle *items = primitives[0].triangles;
+    std::vector<const BVHBuildPrim*> triPrims;
+    for (size_t p = 0; p < nPrims; p++)
+        triPrims.insert(triPrims.end(), primitives[p].nTriangles, &primitives[p]);
+    const size_t n = triPrims.size();
+
+    BB cbounds;
+    cbounds.min = cbounds.max = items[0].centroid;
+    for (size_t i = 1; i < n; i++)
+        cbounds.update(items[i].centroid);
+    const Vector extent = cbounds.min.vec2point(cbounds.max);
+    const float sx = extent.X > 0.f ? 1.f / extent.X : 0.f;
+    const float sy = extent.Y > 0.f ? 1.f / extent.Y : 0.f;
+    const float sz = extent.Z > 0.f ? 1.f / extent.Z : 0.f;
+
+    std::vector<MortonPrim> morton(n);
+    const int nChunks = buildPool ? buildPool->size() : 1;
+    const size_t chunkSize = (n + nChunks - 1) / nChunks;
+    parallelFor(nChunks, [&](int c)
+    {
+        const size_t end = std::min(n, (c + 1) * chunkSize);
+        for (size_t i = c * chunkSize; i < end; i++)
+        {
+            const Point p = items[i].centroid;
+            morton[i].code = mortonCode((p.X - cbounds.min.X) * sx, (p.Y - cbounds.min.Y) * sy,
+                                        (p.Z - cbounds.min.Z) * sz);
+            morton[i].index = (uint32_t)i;
+        }
+    });
+    radixSort(morton);
+
+    std::vector<uint32_t> codes(n);
+    std::vector<uint32_t> sortedTriangles(n);
+    std::vector<const BVHBuildPrim*> sortedPrims(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        codes[i] = morton[i].code;
+        sortedTriangles[i] = items[morton[i].index].index;
+        sortedPrims[i] = triPrims[morton[i].index];
+    }
+
+    const int topBit = 3 * MORTON_BITS - 1;
+    if (splitMethod == SPLIT_LBVH)
+    {
+        BVHNodeGeo *root = emitLBVH(codes.data(), sortedTriangles.data(), sortedPrims.data(), n, topBit);
+        if (buildPool) buildPool->wait();
+        fitBVHGeo(root, items);
+        return root;
+    }
+
+    // one treelet per run of equal high bits
+    std::vector<size_t> starts;
+    const uint32_t clusterMask = ~((1u << (topBit + 1 - HLBVH_CLUSTER_BITS)) - 1);
+    for (size_t i = 0; i < n; i++)
+        if (i == 0 || (codes[i] & clusterMask) != (codes[i - 1] & clusterMask))
+            starts.push_back(i);
+    starts.push_back(n);
+
+    std::vector<BVHNodeGeo*> treelets(starts.size() - 1);
+    const uint32_t *c = codes.data();
+    const uint32_t *tris = sortedTriangles.data();
+    const BVHBuildPrim **ps = sortedPrims.data();
+    for (size_t t = 0; t + 1 < starts.size(); t++)
+    {
+        const size_t s = starts[t], count = starts[t + 1] - s;
+        BVHNodeGeo **dst = &treelets[t];
+        spawn(count, [=] { *dst = emitLBVH(c + s, tris + s, ps + s, count, topBit - HLBVH_CLUSTER_BITS); });
+    }
+    if (buildPool) buildPool->wait();
+    for (BVHNodeGeo *t : treelets)
+        fitBVHGeo(t, items);
+    return buildTreelets(treelets.data(), treelets.size(), 0);
+}
+
 
 void BVH::deleteBVH(BVHNode* node) {
     if (!node) return;
@@ -281,3 +878,59 @@ void BVH::deleteBVHGeo(BVHNodeGeo* node) {
     deleteBVHGeo(node->right);
     delete node;
 }
+
+// Expected traversal work for a ray that hits the root box: a node is hit with
+// probability area(node)/area(root) (see pbrt book (3rd ed.), sec 4.3.2)
+void BVH::computeCost(int n, int depth, float rootArea, BVHCost &cost)
+{
+    const LinearBVHNode &node = nodes[n];
+    const float p = node.boundingBox.area() / rootArea;
+    cost.nodes++;
+    cost.nodeVisits += p;
+    cost.maxDepth = std::max(cost.maxDepth, depth);
+    if (node.nItems > 0)
+    {
+        cost.leaves++;
+        cost.items += node.nItems;
+        if (type == 0)
+        { // a primitive leaf tests every face of the mesh
+            Geometry *g = orderedPrims[node.itemsOffset]->g;
+            cost.itemTests += p * (dynamic_cast<Mesh *>(g) ? ((Mesh *)g)->numFaces : 1);
+        }
+        else
+            cost.itemTests += p * node.nItems;
+    }
+    else
+    {
+        computeCost(n + 1, depth + 1, rootArea, cost);
+        computeCost(node.secondChildOffset, depth + 1, rootArea, cost);
+    }
+}
+
+BVHCost BVH::cost()
+{
+    BVHCost c;
+    if (totalNodes > 0)
+        computeCost(0, 0, nodes[0].boundingBox.area(), c);
+    return c;
+}
+
+void BVH::printCost()
+{
+    BVHCost c = cost();
+    printf("BVH (%s split): %d nodes, %d leaves, max depth %d, %.1f %s per leaf\n",
+           bvhSplitMethodName(splitMethod), c.nodes, c.leaves, c.maxDepth,
+           c.leaves ? (double)c.items / c.leaves : 0., type == 0 ? "primitives" : "triangles");
+    printf("    expected per ray: %.2f node visits, %.2f triangle tests (SAH cost %.2f)\n",
+           c.nodeVisits, c.itemTests,
+           SAH_TRAVERSAL_COST * c.nodeVisits + SAH_INTERSECT_COST * c.itemTests);
+}
+
+void BVH::printStats()
+{
+    const long rays = statRays.load();
+    if (!BVH_TRACE_STATS || rays == 0) return;
+    printf("BVH traversal: %ld rays, %.2f box tests, %.2f %s tests per ray\n", rays,
+           (double)statNodeTests.load() / rays, (double)statItemTests.load() / rays,
+           type == 0 ? "primitive" : "triangle");
+}
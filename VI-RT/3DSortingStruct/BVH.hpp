@@ -3,6 +3,9 @@
 
 #include <algorithm>
 #include <vector>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
 #include "AccelStruct.hpp"
 #include "ray.hpp"
 #include "intersection.hpp"
@@ -10,43 +13,164 @@
 #include "primitive.hpp"
 #include "triangle.hpp"
 #include "mesh.hpp"
+#include "TriangleBuffer.hpp"
 
 struct BVHNode {
     BB boundingBox;
     BVHNode *left, *right;
     Primitive *primitive;
+    int axis;
 
-    BVHNode() : left(nullptr), right(nullptr), primitive(nullptr) {}
+    BVHNode() : left(nullptr), right(nullptr), primitive(nullptr), axis(0) {}
+};
+
+// item of the triangle level build: a triangle of the build's TriangleBuffer
+// with its box and centroid, which the builders look at many times
+struct BVHBuildTriangle {
+    BB bb;
+    Point centroid;
+    uint32_t index;
+};
+
+// item of the triangle level build: a primitive and its triangles
+struct BVHBuildPrim {
+    Primitive *prim;
+    BVHBuildTriangle *triangles;
+    size_t nTriangles;
 };
 
 struct BVHNodeGeo {
     BB boundingBox;
     BVHNodeGeo *left, *right;
-    std::vector<Triangle*> triangles;
-    int materialIndex;
+    std::vector<uint32_t> triangles;    // leaf triangles, in the build's TriangleBuffer
+    const BVHBuildPrim *source; // the triangles of a leaf come from this primitive
+    int axis;
+
+    BVHNodeGeo() : left(nullptr), right(nullptr), source(nullptr), axis(0) {}
+};
+
+// Compact node used for traversal (see pbrt book (3rd ed.), sec 4.3.4).
+// Nodes are stored in one array in depth first order: the first child of an
+// interior node is the next node in the array, the second one is at
+// secondChildOffset. Leaves reference nItems consecutive entries of the
+// ordered primitive / triangle arrays, starting at itemsOffset.
+struct alignas(32) LinearBVHNode {
+    BB boundingBox;
+    union {
+        int itemsOffset;        // leaf
+        int secondChildOffset;  // interior
+    };
+    uint16_t nItems;            // 0 for interior nodes
+    uint8_t axis;               // split axis of interior nodes
+    uint8_t pad;
+};
+
+// traversal keeps the nodes still to visit in a fixed size stack
+const int BVH_STACK_SIZE = 64;
 
-    BVHNodeGeo() : left(nullptr), right(nullptr), materialIndex(-1) {}
+// how the builder splits a set of primitives / triangles in two
+enum BVHSplitMethod {
+    SPLIT_MEDIAN = 0,   // median along the largest axis
+    SPLIT_SAH = 1,      // binned Surface Area Heuristic
+    SPLIT_LBVH = 2,     // Morton code order (triangle level only, else median)
+    SPLIT_HLBVH = 3     // LBVH treelets joined by a SAH top tree (idem)
 };
 
+static inline const char *bvhSplitMethodName(int splitMethod)
+{
+    static const char *names[] = { "median", "SAH", "LBVH", "HLBVH" };
+    return names[splitMethod];
+}
+
+// SAH weights: cost of visiting a node relative to a triangle test
+const float SAH_TRAVERSAL_COST = 1.f;
+const float SAH_INTERSECT_COST = 1.f;
+// refit() rebuilds the tree once its SAH cost exceeds this ratio of the cost
+// right after the last build
+const float REFIT_REBUILD_RATIO = 1.3f;
+
+// SAH estimates of the cost of tracing one ray through the tree
+struct BVHCost {
+    int nodes, leaves, maxDepth;
+    long items;          // primitives referenced by the leaves
+    double nodeVisits;   // expected nodes whose box is hit
+    double itemTests;    // expected triangle intersection tests
+    BVHCost() : nodes(0), leaves(0), maxDepth(0), items(0), nodeVisits(0.), itemTests(0.) {}
+};
+
+// triangle and its Morton code, sorted by the LBVH builder
+struct MortonPrim {
+    uint32_t code;
+    uint32_t index;
+};
+
+class ThreadPool;
+
 class BVH : public AccelStruct {
+    friend class BVH4;      // collapses the binary tree into a 4-wide one
+    friend class MeshBVH;   // keeps the tree of a single mesh
 private:
     int type;
-    BVHNode *root;
-    BVHNodeGeo *rootGeo;
-    BVHNode *buildBVH(std::vector<Primitive*>& primitives, int depth);
-    BVHNodeGeo *buildBVHGeoAux(std::vector<Triangle*>& triangles, int materialIndex, int depth);
-    BVHNodeGeo *buildBVHGeo(std::vector<Primitive*>& primitives, int depth);
-    bool traverseBVH(BVHNode *node, Ray &r, Intersection *isect);
-    bool traverseBVHGeo(BVHNodeGeo* node, Ray& r, Intersection* isect);
+    int splitMethod;
+
+    // pointer based trees, only used while building; the builders partition
+    // their item range in place
+    BVHNode *buildBVH(Primitive **primitives, size_t n, int depth);
+    BVHNodeGeo *buildBVHGeoAux(BVHBuildTriangle *triangles, size_t n, const BVHBuildPrim *source, int depth);
+    BVHNodeGeo *buildBVHGeo(BVHBuildPrim *primitives, size_t n, int depth);
+    BVHNodeGeo *buildLBVH(BVHBuildPrim *primitives, size_t n);
+    BVHNodeGeo *emitLBVH(const uint32_t *codes, const uint32_t *triangles, const BVHBuildPrim **prims, size_t n,
+                         int bitIndex);
+    void radixSort(std::vector<MortonPrim> &v);
+    // run task(0..n-1) on the build pool (if any) and wait for them
+    void parallelFor(int n, std::function<void(int)> task);
+    // run a subtree build as a task of buildPool if it has at least
+    // PARALLEL_BUILD_CUTOFF items (BVH.cpp), otherwise right away
+    void spawn(size_t n, std::function<void()> task);
+    int nBuildThreads;      // 1 : serial build, 0 : one thread per core
+    ThreadPool *buildPool;  // only set while a parallel build runs
+    int flattenBVH(BVHNode *node, int *offset);
+    int flattenBVHGeo(BVHNodeGeo *node, int *offset, std::vector<uint32_t> &order);
     void deleteBVH(BVHNode* node);
     void deleteBVHGeo(BVHNodeGeo* node);
 
+    // compact representation used for traversal
+    LinearBVHNode *nodes;
+    int totalNodes;
+    std::vector<Primitive*> orderedPrims;       // leaf primitives (type 0)
+    TriangleBuffer orderedTriangles;            // leaf triangles (type 1)
+    std::vector<Primitive*> trianglePrim;       // primitive (material / light) of each ordered triangle
+    // index of each ordered triangle in the order they were added (the face
+    // of a single mesh); only kept if keepTriangleOrder is set (MeshBVH)
+    bool keepTriangleOrder;
+    std::vector<uint32_t> triangleOrder;
+    float builtCost;                            // SAH cost after the last build
+    void allocNodes(int n);
+    void computeCost(int node, int depth, float rootArea, BVHCost &cost);
+
+    // measured traversal work, counted when BVH_TRACE_STATS is set (BVH.cpp)
+    std::atomic<long> statRays, statNodeTests, statItemTests;
+
 public:
 
-    BVH(int _type=0): type(_type){}
-    ~BVH(){deleteBVH(root); deleteBVHGeo(rootGeo);}
+    BVH(int _type=0, int _splitMethod=SPLIT_MEDIAN, int _nBuildThreads=0): type(_type), splitMethod(_splitMethod),
+        nBuildThreads(_nBuildThreads), buildPool(nullptr), nodes(nullptr), totalNodes(0),
+        keepTriangleOrder(false), builtCost(0.f), statRays(0), statNodeTests(0), statItemTests(0), buildTime(0.) {}
+    ~BVH();
     void build(Scene *scene);
-    bool trace (Ray r, Intersection *isect);
+    // build over the given primitives (the scene is only needed to trace)
+    void build(std::vector<Primitive*> prims);
+    bool trace (const Ray &r, Intersection *isect);
+    bool occluded (const Ray &r, float tmax);
+    // update the node boxes (and the triangles) after the meshes moved their
+    // vertices (see Mesh::updateGeometry); rebuilds the tree instead, and
+    // returns false, if the refitted one costs REFIT_REBUILD_RATIO times more
+    bool refit();
+    bool tracesInstances () const { return type == 0; }
+    BVHCost cost();
+    void printCost();
+    void printStats();
+    double buildTime;       // wall clock seconds of the last tree construction
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,482 @@
+#include "BVH4.hpp"
+#include "scene.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define BVH4_SSE 1
+#endif
+
+// each visited node pushes at most 3 more entries than it pops
+const int BVH4_STACK_SIZE = 3 * BVH_STACK_SIZE + 1;
+
+struct BVH4StackEntry {
+    int child;
+    int nItems;     // > 0 : leaf
+    float tEnter;
+};
+
+void BVH4::build(Scene *scene)
+{
+    this->scene = scene;
+
+    // build and flatten a binary triangle level BVH, then collapse it
+    BVH bin(1, splitMethod, nBuildThreads);
+    bin.verbose = verbose;
+    bin.build(scene);
+
+    std::vector<BVH4Node> tree;
+    if (bin.totalNodes > 0)
+        collapse(bin.nodes, 0, tree);
+
+    void *mem = nullptr;
+    // 128 byte nodes, cache line aligned
+    if (posix_memalign(&mem, 64, tree.size() * sizeof(BVH4Node)) != 0)
+        mem = nullptr;
+    free(nodes);
+    nodes = (BVH4Node *)mem;
+    totalNodes = (int)tree.size();
+    if (totalNodes > 0)
+        memcpy(nodes, tree.data(), tree.size() * sizeof(BVH4Node));
+
+    orderedTriangles = std::move(bin.orderedTriangles);
+    trianglePrim = std::move(bin.trianglePrim);
+    packLeaves();
+    builtCost = sahCost();
+
+    if (verbose)
+        printf("BVH4: %d nodes (%.1lf KB) collapsed from %d binary nodes, %lu triangle packs (%.1lf KB)\n",
+               totalNodes, totalNodes * sizeof(BVH4Node) / 1024., bin.totalNodes, packs.size(),
+               packs.size() * sizeof(TriPack4) / 1024.);
+}
+
+void BVH4::packLeaves()
+{
+    packs.clear();
+    for (int n = 0; n < totalNodes; n++)
+    {
+        BVH4Node &node = nodes[n];
+        for (int i = 0; i < node.nChildren; i++)
+        {
+            if (node.nItems[i] == 0) continue;
+            const int first = node.child[i];
+            node.child[i] = (int)packs.size();
+            for (int t = 0; t < node.nItems[i]; t += 4)
+            {
+                uint32_t tris[4];
+                const int count = std::min(4, node.nItems[i] - t);
+                for (int k = 0; k < count; k++)
+                    tris[k] = (uint32_t)(first + t + k);
+                packs.push_back(TriPack4());
+                packs.back().set(orderedTriangles, tris, count);
+            }
+        }
+    }
+}
+
+// expected node visits plus triangle tests of a ray that hits the root
+// (see BVH::computeCost)
+float BVH4::sahCost() const
+{
+    if (totalNodes == 0) return 0.f;
+
+    BB root;
+    root.min = Point(nodes[0].bmin[0][0], nodes[0].bmin[1][0], nodes[0].bmin[2][0]);
+    root.max = Point(nodes[0].bmax[0][0], nodes[0].bmax[1][0], nodes[0].bmax[2][0]);
+    for (int i = 1; i < nodes[0].nChildren; i++)
+    {
+        root.update(Point(nodes[0].bmin[0][i], nodes[0].bmin[1][i], nodes[0].bmin[2][i]));
+        root.update(Point(nodes[0].bmax[0][i], nodes[0].bmax[1][i], nodes[0].bmax[2][i]));
+    }
+    const float rootArea = root.area();
+    if (rootArea <= 0.f) return 0.f;
+
+    float cost = SAH_TRAVERSAL_COST;
+    for (int n = 0; n < totalNodes; n++)
+    {
+        const BVH4Node &node = nodes[n];
+        for (int i = 0; i < node.nChildren; i++)
+        {
+            BB box;
+            box.min = Point(node.bmin[0][i], node.bmin[1][i], node.bmin[2][i]);
+            box.max = Point(node.bmax[0][i], node.bmax[1][i], node.bmax[2][i]);
+            const float p = box.area() / rootArea;
+            cost += p * (node.nItems[i] > 0 ? SAH_INTERSECT_COST * node.nItems[i] : SAH_TRAVERSAL_COST);
+        }
+    }
+    return cost;
+}
+
+bool BVH4::refit()
+{
+    if (totalNodes == 0)
+        return true;
+
+    orderedTriangles.updateVertices();
+
+    // collapse() stores a node before its children: sweep backwards
+    for (int n = totalNodes - 1; n >= 0; n--)
+    {
+        BVH4Node &node = nodes[n];
+        for (int i = 0; i < node.nChildren; i++)
+        {
+            BB box;
+            if (node.nItems[i] > 0)
+            { // repack the moved triangles
+                box = orderedTriangles.bounds(packs[node.child[i]].tri[0]);
+                for (int p = node.child[i]; p < node.child[i] + (node.nItems[i] + 3) / 4; p++)
+                {
+                    uint32_t tris[4];
+                    int count = 0;
+                    for (; count < 4 && packs[p].tri[count] >= 0; count++)
+                    {
+                        tris[count] = (uint32_t)packs[p].tri[count];
+                        box.update(orderedTriangles.bounds(tris[count]));
+                    }
+                    packs[p].set(orderedTriangles, tris, count);
+                }
+            }
+            else
+            {
+                const BVH4Node &c = nodes[node.child[i]];
+                box.min = Point(c.bmin[0][0], c.bmin[1][0], c.bmin[2][0]);
+                box.max = Point(c.bmax[0][0], c.bmax[1][0], c.bmax[2][0]);
+                for (int j = 1; j < c.nChildren; j++)
+                {
+                    box.update(Point(c.bmin[0][j], c.bmin[1][j], c.bmin[2][j]));
+                    box.update(Point(c.bmax[0][j], c.bmax[1][j], c.bmax[2][j]));
+                }
+            }
+            node.bmin[0][i] = box.min.X;
+            node.bmin[1][i] = box.min.Y;
+            node.bmin[2][i] = box.min.Z;
+            node.bmax[0][i] = box.max.X;
+            node.bmax[1][i] = box.max.Y;
+            node.bmax[2][i] = box.max.Z;
+        }
+    }
+
+    if (sahCost() > REFIT_REBUILD_RATIO * builtCost)
+    {
+        build(scene);
+        return false;
+    }
+    return true;
+}
+
+BVH4::~BVH4()
+{
+    free(nodes);
+}
+
+int BVH4::collapse(const LinearBVHNode *bin, int n, std::vector<BVH4Node> &out)
+{
+    // children of the new node: start with the binary children and open the
+    // interior one with the largest area until there are 4
+    int cand[4], nc;
+    if (bin[n].nItems > 0)
+    { // the root is a leaf
+        cand[0] = n;
+        nc = 1;
+    }
+    else
+    {
+        cand[0] = n + 1;
+        cand[1] = bin[n].secondChildOffset;
+        nc = 2;
+    }
+    while (nc < 4)
+    {
+        int best = -1;
+        float bestArea = -1.f;
+        for (int i = 0; i < nc; i++)
+        {
+            const float area = bin[cand[i]].boundingBox.area();
+            if (bin[cand[i]].nItems == 0 && area > bestArea)
+            {
+                best = i;
+                bestArea = area;
+            }
+        }
+        if (best < 0) break;
+        const int c = cand[best];
+        cand[best] = c + 1;
+        cand[nc++] = bin[c].secondChildOffset;
+    }
+
+    const int me = (int)out.size();
+    BVH4Node node;
+    for (int i = 0; i < 4; i++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            node.bmin[a][i] = INFINITY;
+            node.bmax[a][i] = -INFINITY;
+        }
+        node.child[i] = -1;
+        node.nItems[i] = 0;
+    }
+    node.nChildren = nc;
+    node.pad = 0;
+    out.push_back(node);
+
+    for (int i = 0; i < nc; i++)
+    {
+        const LinearBVHNode &c = bin[cand[i]];
+        BVH4Node &dst = out[me];
+        dst.bmin[0][i] = c.boundingBox.min.X;
+        dst.bmin[1][i] = c.boundingBox.min.Y;
+        dst.bmin[2][i] = c.boundingBox.min.Z;
+        dst.bmax[0][i] = c.boundingBox.max.X;
+        dst.bmax[1][i] = c.boundingBox.max.Y;
+        dst.bmax[2][i] = c.boundingBox.max.Z;
+        if (c.nItems > 0)
+        {
+            dst.child[i] = c.itemsOffset;
+            dst.nItems[i] = c.nItems;
+        }
+        else
+        {
+            // out may grow (and move) while collapsing the child
+            const int childNode = collapse(bin, cand[i], out);
+            out[me].child[i] = childNode;
+        }
+    }
+    return me;
+}
+
+#ifdef BVH4_SSE
+
+int BVH4::intersectChildren(const BVH4Node &node, const Ray &r, float tmax, float tEnter[4]) const
+{
+    const float o[3] = { r.o.X, r.o.Y, r.o.Z };
+    const float inv[3] = { r.invDir.X, r.invDir.Y, r.invDir.Z };
+
+    __m128 t0 = _mm_setzero_ps();
+    __m128 t1 = _mm_set1_ps(tmax);
+    for (int a = 0; a < 3; a++)
+    {
+        const __m128 ro = _mm_set1_ps(o[a]);
+        const __m128 ri = _mm_set1_ps(inv[a]);
+        const __m128 lo = _mm_load_ps(r.sign[a] ? node.bmax[a] : node.bmin[a]);
+        const __m128 hi = _mm_load_ps(r.sign[a] ? node.bmin[a] : node.bmax[a]);
+        // max/min return their second operand when the first is NaN (0 * inf,
+        // ray in a slab plane), so such slabs do not reject the box
+        t0 = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(lo, ro), ri), t0);
+        t1 = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(hi, ro), ri), t1);
+    }
+    _mm_storeu_ps(tEnter, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+#else
+
+int BVH4::intersectChildren(const BVH4Node &node, const Ray &r, float tmax, float tEnter[4]) const
+{
+    const float o[3] = { r.o.X, r.o.Y, r.o.Z };
+    const float inv[3] = { r.invDir.X, r.invDir.Y, r.invDir.Z };
+    int mask = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        float t0 = 0.f, t1 = tmax;
+        for (int a = 0; a < 3; a++)
+        {
+            const float lo = (r.sign[a] ? node.bmax[a][i] : node.bmin[a][i]);
+            const float hi = (r.sign[a] ? node.bmin[a][i] : node.bmax[a][i]);
+            const float tlo = (lo - o[a]) * inv[a], thi = (hi - o[a]) * inv[a];
+            // same NaN behaviour as the SSE version
+            t0 = (tlo > t0) ? tlo : t0;
+            t1 = (thi < t1) ? thi : t1;
+        }
+        tEnter[i] = t0;
+        if (t0 <= t1) mask |= 1 << i;
+    }
+    return mask;
+}
+
+#endif
+
+bool BVH4::trace (const Ray &r, Intersection *isect)
+{
+    if (totalNodes == 0) return false;
+
+    BVH4StackEntry stack[BVH4_STACK_SIZE];
+    int top = 0;
+    TriangleHit hit;
+
+    stack[top++] = { 0, 0, 0.f };
+    while (top > 0)
+    {
+        const BVH4StackEntry e = stack[--top];
+        if (e.tEnter > hit.t)
+            continue;
+
+        if (e.nItems > 0)
+        { // leaf: intersect its triangle packs, keeping the closest hit
+            for (int p = e.child; p < e.child + (e.nItems + 3) / 4; p++)
+                intersectTriPack4(packs[p], r, &hit);
+            continue;
+        }
+
+        const BVH4Node &node = nodes[e.child];
+        float tEnter[4];
+        const int mask = intersectChildren(node, r, hit.t, tEnter);
+
+        // push the children hit from the farthest to the nearest,
+        // so that the nearest one is popped first
+        int order[4], n = 0;
+        for (int i = 0; i < node.nChildren; i++)
+        {
+            if (!(mask & (1 << i))) continue;
+            int j = n++;
+            while (j > 0 && tEnter[order[j - 1]] < tEnter[i])
+            {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+        for (int k = 0; k < n; k++)
+        {
+            const int i = order[k];
+            stack[top++] = { node.child[i], node.nItems[i], tEnter[i] };
+        }
+    }
+
+    // the hit data is only computed for the closest hit
+    if (hit.triangle < 0)
+        return false;
+    orderedTriangles.fillHit(hit, r, isect);
+    setHitInfo(trianglePrim[hit.triangle], isect);
+    return true;
+}
+
+// any hit query: no ordering, lights do not cast shadows (see BVH::occluded)
+bool BVH4::occluded (const Ray &r, float tmax)
+{
+    if (totalNodes == 0) return false;
+
+    int stack[BVH4_STACK_SIZE];
+    int top = 0;
+
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const BVH4Node &node = nodes[stack[--top]];
+        float tEnter[4];
+        const int mask = intersectChildren(node, r, tmax, tEnter);
+
+        for (int i = 0; i < node.nChildren; i++)
+        {
+            if (!(mask & (1 << i))) continue;
+            if (node.nItems[i] == 0)
+            {
+                stack[top++] = node.child[i];
+                continue;
+            }
+            for (int p = node.child[i]; p < node.child[i] + (node.nItems[i] + 3) / 4; p++)
+            {
+                float t[4], u[4], v[4];
+                const int mask = intersectTriPack4(packs[p], r, tmax, t, u, v);
+                for (int k = 0; k < 4; k++)
+                    if ((mask & (1 << k)) && trianglePrim[packs[p].tri[k]]->light_ndx < 0)
+                        return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Packet traversal: the rays share one node stack. At each node every active
+// ray is tested against the 4 children, a child is visited by the rays that
+// hit it (rays mask), nearest child first by the smallest entry distance.
+void BVH4::traceRays (RayPacket8 &packet, IntersectionPacket8 &isects)
+{
+    const int n = packet.n;
+    TriangleHit hit[PACKET_SIZE];
+    for (int k = 0; k < n; k++)
+        isects.hit[k] = false;
+    if (totalNodes == 0 || n == 0) return;
+
+    struct Entry {
+        int child;
+        int nItems;
+        int rays;       // bit k set: ray k visits this child
+        float tEnter;   // smallest entry distance over those rays
+    };
+    Entry stack[BVH4_STACK_SIZE];
+    int top = 0;
+
+    stack[top++] = { 0, 0, (1 << n) - 1, 0.f };
+    while (top > 0)
+    {
+        const Entry e = stack[--top];
+
+        // cull if the child starts beyond the closest hit of all its rays
+        float tFarthest = 0.f;
+        for (int k = 0; k < n; k++)
+            if ((e.rays & (1 << k)) && hit[k].t > tFarthest)
+                tFarthest = hit[k].t;
+        if (e.tEnter > tFarthest)
+            continue;
+
+        if (e.nItems > 0)
+        { // leaf: intersect its triangles with the rays that reached it
+            for (int k = 0; k < n; k++)
+            {
+                if (!(e.rays & (1 << k))) continue;
+                for (int p = e.child; p < e.child + (e.nItems + 3) / 4; p++)
+                    intersectTriPack4(packs[p], packet.rays[k], &hit[k]);
+            }
+            continue;
+        }
+
+        const BVH4Node &node = nodes[e.child];
+        int childRays[4] = { 0, 0, 0, 0 };
+        float childT[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+        for (int k = 0; k < n; k++)
+        {
+            if (!(e.rays & (1 << k))) continue;
+            float tEnter[4];
+            const int mask = intersectChildren(node, packet.rays[k], hit[k].t, tEnter);
+            for (int i = 0; i < node.nChildren; i++)
+            {
+                if (!(mask & (1 << i))) continue;
+                childRays[i] |= 1 << k;
+                if (tEnter[i] < childT[i]) childT[i] = tEnter[i];
+            }
+        }
+
+        // push from the farthest to the nearest
+        int order[4], m = 0;
+        for (int i = 0; i < node.nChildren; i++)
+        {
+            if (!childRays[i]) continue;
+            int j = m++;
+            while (j > 0 && childT[order[j - 1]] < childT[i])
+            {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+        for (int c = 0; c < m; c++)
+        {
+            const int i = order[c];
+            stack[top++] = { node.child[i], node.nItems[i], childRays[i], childT[i] };
+        }
+    }
+
+    for (int k = 0; k < n; k++)
+    {
+        if (hit[k].triangle < 0) continue;
+        isects.hit[k] = true;
+        orderedTriangles.fillHit(hit[k], packet.rays[k], &isects.isect[k]);
+        setHitInfo(trianglePrim[hit[k].triangle], &isects.isect[k]);
+    }
+}
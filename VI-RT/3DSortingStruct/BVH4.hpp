@@ -0,0 +1,58 @@
+#ifndef BVH4_H
+#define BVH4_H
+
+#include <vector>
+#include <stdint.h>
+#include "AccelStruct.hpp"
+#include "BVH.hpp"
+#include "TriPack.hpp"
+
+// 4-wide node: the boxes of the 4 children are stored as structure of arrays
+// (bmin[axis][child]) so that one SSE slab test intersects all of them.
+// Unused child slots have an empty (inverted) box and are never hit.
+struct alignas(16) BVH4Node {
+    float bmin[3][4];
+    float bmax[3][4];
+    int child[4];           // interior child: node index, leaf child: first triangle pack
+    uint16_t nItems[4];     // triangles of a leaf child, 0 for interior (or unused) slots
+    int nChildren;
+    int pad;
+};
+
+// BVH with 4 children per node, obtained by collapsing a binary (triangle
+// level) BVH: each node pulls up the grandchildren of its largest interior
+// children until it has 4. Traversal tests the 4 child boxes at once with
+// the ray's reciprocal direction and visits the hit ones nearest first.
+// Leaf triangles are stored in packs of 4 (TriPack4), each intersected by
+// one SIMD test. Uses SSE when available and scalar loops otherwise.
+class BVH4 : public AccelStruct {
+private:
+    int splitMethod;
+    int nBuildThreads;  // of the binary builder, see BVH
+    BVH4Node *nodes;
+    int totalNodes;
+    TriangleBuffer orderedTriangles;
+    std::vector<Primitive*> trianglePrim;
+    std::vector<TriPack4> packs;        // leaf triangles, a leaf with n of them has (n+3)/4 packs
+    float builtCost;    // SAH cost after the last build
+
+    int collapse(const LinearBVHNode *bin, int n, std::vector<BVH4Node> &out);
+    // pack the leaf triangles and point the leaves to their packs
+    void packLeaves();
+    // slab test of the 4 children of node against [0, tmax]: returns a bit mask
+    // of the children hit and their entry distances in tEnter
+    int intersectChildren(const BVH4Node &node, const Ray &r, float tmax, float tEnter[4]) const;
+    float sahCost() const;
+
+public:
+    BVH4(int _splitMethod=SPLIT_SAH, int _nBuildThreads=0): splitMethod(_splitMethod),
+        nBuildThreads(_nBuildThreads), nodes(nullptr), totalNodes(0), builtCost(0.f) {}
+    ~BVH4();
+    void build(Scene *scene);
+    bool trace (const Ray &r, Intersection *isect);
+    bool occluded (const Ray &r, float tmax);
+    void traceRays (RayPacket8 &packet, IntersectionPacket8 &isects);
+    bool refit ();      // see BVH::refit
+};
+
+#endif
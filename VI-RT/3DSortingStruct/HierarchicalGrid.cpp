@@ -12,36 +12,17 @@ void HierarchicalGrid::build(Scene *scene)
 {
     this->scene = scene;
 
-    std::vector<Primitive *> primitives = scene->getPrims();
-    std::vector<Primitive *> triangles;
-
-    // build vector with every triangle in the mesh and their respective material_ndx
+    std::vector<Primitive *> primitives = getPrimitives(scene);
 
+    // every triangle of the meshes, instances (in world space) and area
+    // lights, with the primitive that has its material
+    triangles.clear();
+    trianglePrim.clear();
     for (const auto &prim : primitives)
-    {
-        if (dynamic_cast<Mesh *>(prim->g))
-        {
-            Mesh *mesh = (Mesh *)prim->g;
-
-            for (const auto &face : mesh->faces)
-            {
-                // fetch triangle vertices
-                Point v1 = mesh->vertices[face.vert_ndx[0]];
-                Point v2 = mesh->vertices[face.vert_ndx[1]];
-                Point v3 = mesh->vertices[face.vert_ndx[2]];
-
-                // create triangle
-                Triangle *tri = new Triangle(v1, v2, v3, face.geoNormal);
-
-                // create primitive with the triangle as its geometry
-                Primitive *primitive = new Primitive();
-                primitive->g = tri;
-                primitive->material_ndx = prim->material_ndx;
-
-                triangles.push_back(primitive);
-            }
-        }
-    }
+        trianglePrim.insert(trianglePrim.end(), triangles.add(prim->g), prim);
+    std::vector<uint32_t> all(triangles.size());
+    for (uint32_t t = 0; t < (uint32_t)all.size(); t++)
+        all[t] = t;
 
     rootCell = new GridCell(0);
 
@@ -56,7 +37,7 @@ void HierarchicalGrid::build(Scene *scene)
     rootCell->calculateSizes();
 
     // Build the root grid
-    buildSubgrid(rootCell, triangles, 0);
+    buildSubgrid(rootCell, all, 0);
 }
 
 int max(int a, int b)
@@ -74,12 +55,12 @@ float interpolate(float min, float max, float t)
     return t * max + (1 - t) * min;
 }
 
-void HierarchicalGrid::buildSubgrid(GridCell *cell, const std::vector<Primitive *> &primitives, int level)
+void HierarchicalGrid::buildSubgrid(GridCell *cell, const std::vector<uint32_t> &cellTriangles, int level)
 {
 
     if (level >= maxDepth)
     { // Limit the depth of the hierarchy
-        cell->primitives = primitives;
+        cell->triangles = cellTriangles;
         return;
     }
     
@@ -111,9 +92,10 @@ void HierarchicalGrid::buildSubgrid(GridCell *cell, const std::vector<Primitive
         }
     }
 
-    std::vector<Primitive *> subgridPrimitives[3][3][3];
-    for (auto &prim : primitives)
+    std::vector<uint32_t> subgridTriangles[3][3][3];
+    for (uint32_t t : cellTriangles)
     {
+        const Triangle geometry = triangles.triangle(t);
 
         for (int x = 0; x < 3; ++x)
         {
@@ -122,14 +104,12 @@ void HierarchicalGrid::buildSubgrid(GridCell *cell, const std::vector<Primitive
                 for (int z = 0; z < 3; ++z)
                 {
 
-                    Triangle *geometry = (Triangle *)prim->g;
-
                     GridCell *sub = cell->subgrid[x][y][z];
 
                     BB cellBB = sub->boundingBox;
 
-                    if (geometry->intersects(cellBB))
-                        subgridPrimitives[x][y][z].push_back(prim);
+                    if (geometry.intersects(cellBB))
+                        subgridTriangles[x][y][z].push_back(t);
                 }
             }
         }
@@ -142,9 +122,9 @@ void HierarchicalGrid::buildSubgrid(GridCell *cell, const std::vector<Primitive
             for (int z = 0; z < 3; ++z)
             {
                 GridCell *sub = cell->subgrid[x][y][z];
-                if (!subgridPrimitives[x][y][z].empty())
+                if (!subgridTriangles[x][y][z].empty())
                 {
-                    buildSubgrid(sub, subgridPrimitives[x][y][z], level + 1);
+                    buildSubgrid(sub, subgridTriangles[x][y][z], level + 1);
                 }
             }
         }
@@ -156,7 +136,7 @@ int clamp(int val, int min, int max)
     return (val < min) ? min : ((val > max) ? max : val);
 }
 
-bool HierarchicalGrid::trace(Ray ray, Intersection *isect)
+bool HierarchicalGrid::trace(const Ray &ray, Intersection *isect)
 {
     // Compute the starting cell
     if (!rootCell->boundingBox.intersect(ray))
@@ -164,41 +144,18 @@ bool HierarchicalGrid::trace(Ray ray, Intersection *isect)
         return false;
     }
 
-    return intersectSubgrid(rootCell, ray, isect);
+    // the Intersection is only filled for the closest hit
+    TriangleHit hit;
+    if (!intersectSubgrid(rootCell, ray, &hit))
+        return false;
+    triangles.fillHit(hit, ray, isect);
+    setHitInfo(trianglePrim[hit.triangle], isect);
+    return true;
 }
 
-bool HierarchicalGrid::intersectSubgrid(GridCell *cell, Ray &ray, Intersection *isect)
+// range of subcells of cell crossed by the ray, false if the ray misses the cell
+bool HierarchicalGrid::subcellRange(GridCell *cell, const Ray &ray, int start[3], int end[3])
 {
-    if (!cell)
-        return false;
-
-    // Check for primitive intersections at the current level
-    Intersection curr_isect;
-    bool hit = false;
-    for (auto &prim : cell->primitives)
-    {
-        if (prim->g->intersect(ray, &curr_isect))
-        {
-            // printf("HIT TRIANGLE\n");
-            if (!hit)
-            {
-                hit = true;
-                *isect = curr_isect;
-                isect->f = this->scene->getMaterial(prim->material_ndx);
-            }
-            else if (isect->depth > curr_isect.depth)
-            {
-                *isect = curr_isect;
-                isect->f = this->scene->getMaterial(prim->material_ndx);
-            }
-        }
-    }
-
-    if (cell->depth >= maxDepth)
-        return hit;
-
-
-
     // Compute the size of the subcells
     Point cellMin = cell->boundingBox.min;
     Point cellMax = cell->boundingBox.max;
@@ -209,7 +166,7 @@ bool HierarchicalGrid::intersectSubgrid(GridCell *cell, Ray &ray, Intersection *
     // Compute the entry and exit points for the ray in the grid
     float tmin, tmax;
     if (!cell->boundingBox.intersect(ray, &tmin, &tmax))
-        return hit;
+        return false;
 
     // printf("%f %f\n", tmin, tmax);
 
@@ -243,10 +200,81 @@ bool HierarchicalGrid::intersectSubgrid(GridCell *cell, Ray &ray, Intersection *
 
     if (startZ > endZ) {
         temp = endZ;
-        endZ = startX;
+        endZ = startZ;
         startZ = temp;
     }
 
+    start[0] = startX; start[1] = startY; start[2] = startZ;
+    end[0] = endX; end[1] = endY; end[2] = endZ;
+    return true;
+}
+
+bool HierarchicalGrid::occluded(const Ray &ray, float tmax)
+{
+    if (!rootCell->boundingBox.intersect(ray))
+    {
+        return false;
+    }
+
+    return occludedSubgrid(rootCell, ray, tmax);
+}
+
+// same walk as intersectSubgrid, but returns as soon as any hit below tmax is found;
+// light sources do not block shadow rays
+bool HierarchicalGrid::occludedSubgrid(GridCell *cell, const Ray &ray, float tmax)
+{
+    if (!cell)
+        return false;
+
+    TriangleHit hit(tmax);
+    for (uint32_t t : cell->triangles)
+    {
+        if (trianglePrim[t]->light_ndx < 0 && triangles.intersect(t, ray, &hit))
+            return true;
+    }
+
+    if (cell->depth >= maxDepth)
+        return false;
+
+    int start[3], end[3];
+    if (!subcellRange(cell, ray, start, end))
+        return false;
+
+    for (int x = start[0]; x <= end[0]; ++x)
+        for (int y = start[1]; y <= end[1]; ++y)
+            for (int z = start[2]; z <= end[2]; ++z)
+                if (occludedSubgrid(cell->subgrid[x][y][z], ray, tmax))
+                    return true;
+
+    return false;
+}
+
+// keeps the closest hit of the triangles of cell and its subcells in hit,
+// returns true if one was found
+bool HierarchicalGrid::intersectSubgrid(GridCell *cell, const Ray &ray, TriangleHit *hit)
+{
+    if (!cell)
+        return false;
+
+    // Check for primitive intersections at the current level
+    bool found = false;
+    for (uint32_t t : cell->triangles)
+    {
+        if (triangles.intersect(t, ray, hit))
+            found = true;
+    }
+
+    if (cell->depth >= maxDepth)
+        return found;
+
+
+
+    int start[3], end[3];
+    if (!subcellRange(cell, ray, start, end))
+        return found;
+    int startX = start[0], startY = start[1], startZ = start[2];
+    int endX = end[0], endY = end[1], endZ = end[2];
+
     std::vector<GridCell*> subcells;
 
     // Traverse the relevant subcells
@@ -258,18 +286,8 @@ bool HierarchicalGrid::intersectSubgrid(GridCell *cell, Ray &ray, Intersection *
             {
                 // if (cell->subgrid[x][y][z])
                 // subcells.push_back(cell->subgrid[x][y][z]);
-                if (intersectSubgrid(cell->subgrid[x][y][z], ray, &curr_isect))
-                {
-                    if (!hit)
-                    {
-                        hit = true;
-                        *isect = curr_isect;
-                    }
-                    else if (isect->depth > curr_isect.depth)
-                    {
-                        *isect = curr_isect;
-                    }
-                }
+                if (intersectSubgrid(cell->subgrid[x][y][z], ray, hit))
+                    found = true;
             }
         }
     }
@@ -317,5 +335,5 @@ bool HierarchicalGrid::intersectSubgrid(GridCell *cell, Ray &ray, Intersection *
     //     }
     // }
 
-    return hit;
+    return found;
 }
@@ -7,20 +7,21 @@
 #include "primitive.hpp" // Assuming this contains your Primitive and Triangle definitions
 #include "ray.hpp" // Assuming this contains your Ray definition
 #include "intersection.hpp" // Assuming this contains your Intersection definition
+#include "TriangleBuffer.hpp"
 
 class Scene;
 
 struct GridCell;
 
 struct GridCell {
-    std::vector<Primitive*> primitives;
+    std::vector<uint32_t> triangles;    // in HierarchicalGrid::triangles
     int depth;
     GridCell* subgrid[3][3][3] = {nullptr}; // Subgrid cells
     float cellSizeX, cellSizeY, cellSizeZ; // Size of each cell
     BB boundingBox;
 
     GridCell(int _depth) 
-    :primitives(), depth(_depth), boundingBox(), cellSizeX(0), cellSizeY(0), cellSizeZ(0)
+    :triangles(), depth(_depth), boundingBox(), cellSizeX(0), cellSizeY(0), cellSizeZ(0)
     {}
 
     void calculateSizes();
@@ -32,13 +33,18 @@ public:
     ~HierarchicalGrid() {}
 
     void build(Scene *scene);
-    bool trace(Ray ray, Intersection* isect);
+    bool trace(const Ray &ray, Intersection *isect);
+    bool occluded(const Ray &ray, float tmax);
 
 private:
     GridCell* rootCell;
     int maxDepth = 1;
-    void buildSubgrid(GridCell* cell, const std::vector<Primitive*>& primitives, int level);
-    bool intersectSubgrid(GridCell* cell, Ray& ray, Intersection* isect);
+    TriangleBuffer triangles;
+    std::vector<Primitive*> trianglePrim;   // primitive (material / light) of each triangle
+    void buildSubgrid(GridCell* cell, const std::vector<uint32_t>& cellTriangles, int level);
+    bool intersectSubgrid(GridCell* cell, const Ray& ray, TriangleHit* hit);
+    bool occludedSubgrid(GridCell* cell, const Ray& ray, float tmax);
+    bool subcellRange(GridCell* cell, const Ray& ray, int start[3], int end[3]);
 };
 
 #endif // HIERARCHICALGRID_H
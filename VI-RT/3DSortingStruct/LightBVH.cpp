@@ -0,0 +1,341 @@
+#include "LightBVH.hpp"
+#include "AreaLight.hpp"
+#include "PointLight.hpp"
+#include <algorithm>
+#include <math.h>
+
+// buckets per axis of the split search
+const int LIGHT_BVH_BUCKETS = 12;
+// below this depth splits minimize the cost, further down the lights are
+// split in halves, which keeps the paths within the 64 bits of lightBits
+const int LIGHT_BVH_COST_DEPTH = 32;
+
+// largest float below 1, keeps the reused random numbers in [0,1[
+const float ONE_MINUS_EPSILON = 0.99999994f;
+
+static inline float safeSqrt(float x) { return sqrtf(std::max(0.f, x)); }
+static inline float safeAcos(float x) { return acosf(std::max(-1.f, std::min(1.f, x))); }
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+static inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    return (cosA > cosB) ? 1.f : cosA * cosB + sinA * sinB;
+}
+static inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    return (cosA > cosB) ? 0.f : sinA * cosB - cosA * sinB;
+}
+
+LightBounds LightBounds::merge(const LightBounds &a, const LightBounds &b)
+{
+    if (a.phi == 0.f) return b;
+    if (b.phi == 0.f) return a;
+    LightBounds m;
+    m.bounds = a.bounds;
+    m.bounds.update(b.bounds);
+    m.phi = a.phi + b.phi;
+    m.cosTheta_e = std::min(a.cosTheta_e, b.cosTheta_e);
+
+    // smallest cone around both normal cones
+    const float theta_a = safeAcos(a.cosTheta_o), theta_b = safeAcos(b.cosTheta_o);
+    const float theta_d = safeAcos(a.w.dot(b.w));
+    if (std::min(theta_d + theta_b, (float)M_PI) <= theta_a) {
+        m.w = a.w;
+        m.cosTheta_o = a.cosTheta_o;
+        return m;
+    }
+    if (std::min(theta_d + theta_a, (float)M_PI) <= theta_b) {
+        m.w = b.w;
+        m.cosTheta_o = b.cosTheta_o;
+        return m;
+    }
+    const float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    Vector axis = a.w.cross(b.w);
+    const float axisLength = axis.norm();
+    if (theta_o >= (float)M_PI || axisLength == 0.f) {
+        m.w = a.w;
+        m.cosTheta_o = -1.f;    // all directions
+        return m;
+    }
+    // rotate a.w towards b.w by theta_o - theta_a
+    axis = axis / axisLength;
+    const float theta_r = theta_o - theta_a;
+    m.w = a.w * cosf(theta_r) + axis.cross(a.w) * sinf(theta_r);
+    m.w.normalize();
+    m.cosTheta_o = cosf(theta_o);
+    return m;
+}
+
+void LightBVHNode::set(const LightBounds &lb)
+{
+    center = lb.bounds.center();
+    radius = 0.5f * lb.bounds.min.vec2point(lb.bounds.max).norm();
+    w = lb.w;
+    phi = lb.phi;
+    cosTheta_o = lb.cosTheta_o;
+    sinTheta_o = safeSqrt(1.f - cosTheta_o * cosTheta_o);
+    cosTheta_e = lb.cosTheta_e;
+}
+
+float LightBVHNode::importance(const Point &p, const Vector &n) const
+{
+    Vector wi = center.vec2point(p);
+    const float dist2 = wi.dot(wi);
+    // do not let the estimate blow up close to (or inside) the bounds
+    const float d2 = std::max(dist2, std::max(radius, 1e-6f));
+
+    const float invDist = (dist2 > 0.f) ? 1.f / sqrtf(dist2) : 0.f;
+    wi = wi * invDist;
+
+    // angle subtended by the bounding sphere (all directions from inside)
+    float cosTheta_b = -1.f, sinTheta_b = 0.f;
+    if (dist2 > radius * radius) {
+        sinTheta_b = radius * invDist;
+        cosTheta_b = safeSqrt(1.f - sinTheta_b * sinTheta_b);
+    }
+
+    // smallest angle between an emitting normal and the direction to p
+    const float cosTheta_w = w.dot(wi);
+    const float sinTheta_w = safeSqrt(1.f - cosTheta_w * cosTheta_w);
+    const float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    const float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    const float cosThetap = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosThetap <= cosTheta_e)
+        return 0.f;
+    float importance = phi * cosThetap / d2;
+
+    // smallest angle between n and a direction to the lights
+    if (n.X != 0.f || n.Y != 0.f || n.Z != 0.f) {
+        const float cosTheta_i = -wi.dot(n);
+        const float sinTheta_i = safeSqrt(1.f - cosTheta_i * cosTheta_i);
+        importance *= std::max(0.f, cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b));
+    }
+    return std::max(importance, 0.f);
+}
+
+// surface area orientation heuristic: the cost of a set of lights grows
+// with its power, the area of its bounds and the solid angle it emits into;
+// elongated parent bounds favour splits across the long axis
+static float splitCost(const LightBounds &b, const Vector &parentDiagonal, int axis)
+{
+    if (b.phi == 0.f) return 0.f;
+    const float theta_o = safeAcos(b.cosTheta_o), theta_e = safeAcos(b.cosTheta_e);
+    const float theta_w = std::min(theta_o + theta_e, (float)M_PI);
+    const float sinTheta_o = safeSqrt(1.f - b.cosTheta_o * b.cosTheta_o);
+    const float M_omega = 2.f * (float)M_PI * (1.f - b.cosTheta_o) +
+                          0.5f * (float)M_PI * (2.f * theta_w * sinTheta_o - cosf(theta_o - 2.f * theta_w) -
+                                                2.f * theta_o * sinTheta_o + b.cosTheta_o);
+    const float d[3] = { parentDiagonal.X, parentDiagonal.Y, parentDiagonal.Z };
+    const float Kr = std::max(d[0], std::max(d[1], d[2])) / d[axis];
+    return b.phi * M_omega * Kr * b.bounds.area();
+}
+
+static float centroid(const LightBounds &b, int axis)
+{
+    const Point c = b.bounds.center();
+    return (axis == 0) ? c.X : ((axis == 1) ? c.Y : c.Z);
+}
+
+void LightBVH::build(const std::vector<Light *> &lights, const std::vector<float> &power)
+{
+    nodes.clear();
+    unbounded.clear();
+    lightBits.assign(lights.size(), 0);
+    lightLeaf.assign(lights.size(), -1);
+    maxDepth = 0;
+
+    std::vector<std::pair<int, LightBounds> > items;
+    for (size_t l = 0; l < lights.size(); l++) {
+        if (!(power[l] > 0.f)) continue;
+        LightBounds lb;
+        lb.phi = power[l];
+        if (lights[l]->type == AREA_LIGHT) {
+            const Triangle *t = ((AreaLight *)lights[l])->gem;
+            lb.bounds.min = lb.bounds.max = t->v1;
+            lb.bounds.update(t->v2);
+            lb.bounds.update(t->v3);
+            lb.w = t->normal;
+            lb.w.normalize();
+            lb.cosTheta_o = 1.f;    // flat: a single normal
+            lb.cosTheta_e = 0.f;    // emits over the hemisphere
+        }
+        else if (lights[l]->type == POINT_LIGHT) {
+            lb.bounds.min = lb.bounds.max = ((PointLight *)lights[l])->pos;
+            lb.cosTheta_o = -1.f;   // emits in all directions
+            lb.cosTheta_e = 0.f;
+        }
+        else {
+            unbounded.push_back((int)l);
+            continue;
+        }
+        items.push_back(std::make_pair((int)l, lb));
+    }
+    if (!items.empty())
+        build(items, 0, (int)items.size(), 0, 0);
+}
+
+int LightBVH::build(std::vector<std::pair<int, LightBounds> > &items, int start, int end, uint64_t bits, int depth)
+{
+    maxDepth = std::max(maxDepth, depth);
+    const int nodeIndex = (int)nodes.size();
+    nodes.push_back(LightBVHNode());
+    if (end - start == 1) {
+        nodes[nodeIndex].set(items[start].second);
+        nodes[nodeIndex].child = items[start].first;
+        nodes[nodeIndex].leaf = true;
+        lightLeaf[items[start].first] = nodeIndex;
+        lightBits[items[start].first] = bits;
+        return nodeIndex;
+    }
+
+    LightBounds all;
+    BB centroids;
+    centroids.min = centroids.max = items[start].second.bounds.center();
+    for (int i = start; i < end; i++) {
+        all = LightBounds::merge(all, items[i].second);
+        const Point c = items[i].second.bounds.center();
+        centroids.min = Point(std::min(centroids.min.X, c.X), std::min(centroids.min.Y, c.Y), std::min(centroids.min.Z, c.Z));
+        centroids.max = Point(std::max(centroids.max.X, c.X), std::max(centroids.max.Y, c.Y), std::max(centroids.max.Z, c.Z));
+    }
+    const Vector diagonal = all.bounds.min.vec2point(all.bounds.max);
+    const float cmin[3] = { centroids.min.X, centroids.min.Y, centroids.min.Z };
+    const float cmax[3] = { centroids.max.X, centroids.max.Y, centroids.max.Z };
+
+    // binned split of least cost over the three axes
+    float minCost = INFINITY;
+    int splitAxis = -1, splitBucket = -1;
+    for (int axis = 0; axis < 3 && depth < LIGHT_BVH_COST_DEPTH; axis++) {
+        if (cmax[axis] == cmin[axis]) continue;
+        LightBounds buckets[LIGHT_BVH_BUCKETS];
+        for (int i = start; i < end; i++) {
+            int b = (int)(LIGHT_BVH_BUCKETS * (centroid(items[i].second, axis) - cmin[axis]) / (cmax[axis] - cmin[axis]));
+            b = std::min(b, LIGHT_BVH_BUCKETS - 1);
+            buckets[b] = LightBounds::merge(buckets[b], items[i].second);
+        }
+        // costs of the splits after each bucket, from both ends
+        LightBounds below[LIGHT_BVH_BUCKETS], above[LIGHT_BVH_BUCKETS];
+        below[0] = buckets[0];
+        for (int b = 1; b < LIGHT_BVH_BUCKETS; b++)
+            below[b] = LightBounds::merge(below[b - 1], buckets[b]);
+        above[LIGHT_BVH_BUCKETS - 1] = buckets[LIGHT_BVH_BUCKETS - 1];
+        for (int b = LIGHT_BVH_BUCKETS - 2; b >= 0; b--)
+            above[b] = LightBounds::merge(above[b + 1], buckets[b]);
+        for (int b = 0; b < LIGHT_BVH_BUCKETS - 1; b++) {
+            if (below[b].phi == 0.f || above[b + 1].phi == 0.f) continue;
+            const float cost = splitCost(below[b], diagonal, axis) + splitCost(above[b + 1], diagonal, axis);
+            if (cost < minCost) {
+                minCost = cost;
+                splitAxis = axis;
+                splitBucket = b;
+            }
+        }
+    }
+
+    int mid = (start + end) / 2;
+    if (splitAxis >= 0) {
+        const float lo = cmin[splitAxis], extent = cmax[splitAxis] - cmin[splitAxis];
+        auto it = std::partition(items.begin() + start, items.begin() + end,
+                                 [=](const std::pair<int, LightBounds> &item) {
+                                     int b = (int)(LIGHT_BVH_BUCKETS * (centroid(item.second, splitAxis) - lo) / extent);
+                                     return std::min(b, LIGHT_BVH_BUCKETS - 1) <= splitBucket;
+                                 });
+        mid = (int)(it - items.begin());
+    }
+    else {
+        // halves along the widest extent of the centroids
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (cmax[a] - cmin[a] > cmax[axis] - cmin[axis]) axis = a;
+        std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                         [=](const std::pair<int, LightBounds> &a, const std::pair<int, LightBounds> &b) {
+                             return centroid(a.second, axis) < centroid(b.second, axis);
+                         });
+    }
+    if (mid == start || mid == end)
+        mid = (start + end) / 2;
+
+    build(items, start, mid, bits, depth + 1);
+    const int second = build(items, mid, end, bits | ((uint64_t)1 << depth), depth + 1);
+    nodes[nodeIndex].set(all);
+    nodes[nodeIndex].child = second;
+    nodes[nodeIndex].leaf = false;
+    return nodeIndex;
+}
+
+float LightBVH::unboundedProbability() const
+{
+    if (unbounded.empty()) return 0.f;
+    return (float)unbounded.size() / (float)(unbounded.size() + (nodes.empty() ? 0 : 1));
+}
+
+int LightBVH::sample(const Point &p, const Vector &n, float u, float *pdf) const
+{
+    const float pUnbounded = unboundedProbability();
+    if (u < pUnbounded) {
+        const int i = std::min((int)(u / pUnbounded * unbounded.size()), (int)unbounded.size() - 1);
+        *pdf = pUnbounded / (float)unbounded.size();
+        return unbounded[i];
+    }
+    *pdf = 0.f;
+    if (nodes.empty())
+        return -1;
+    u = std::min((u - pUnbounded) / (1.f - pUnbounded), ONE_MINUS_EPSILON);
+
+    float prob = 1.f - pUnbounded;
+    int node = 0;
+    while (!nodes[node].leaf) {
+        const int c0 = node + 1, c1 = nodes[node].child;
+        const float i0 = nodes[c0].importance(p, n), i1 = nodes[c1].importance(p, n);
+        if (i0 == 0.f && i1 == 0.f)
+            return -1;
+        // choose a child and reuse u to go on down
+        const float p0 = i0 / (i0 + i1);
+        if (u < p0) {
+            node = c0;
+            prob *= p0;
+            u = std::min(u / p0, ONE_MINUS_EPSILON);
+        }
+        else {
+            node = c1;
+            prob *= 1.f - p0;
+            u = std::min((u - p0) / (1.f - p0), ONE_MINUS_EPSILON);
+        }
+    }
+    // the children were weighed by importance, not the root
+    if (node == 0 && nodes[0].importance(p, n) == 0.f)
+        return -1;
+    *pdf = prob;
+    return nodes[node].child;
+}
+
+float LightBVH::pdf(int l, const Point &p, const Vector &n) const
+{
+    const float pUnbounded = unboundedProbability();
+    if (lightLeaf[l] < 0) {
+        if (std::find(unbounded.begin(), unbounded.end(), l) == unbounded.end())
+            return 0.f;
+        return pUnbounded / (float)unbounded.size();
+    }
+    if (nodes[0].leaf)
+        return (nodes[0].importance(p, n) > 0.f) ? 1.f - pUnbounded : 0.f;
+
+    float prob = 1.f - pUnbounded;
+    uint64_t bits = lightBits[l];
+    int node = 0;
+    while (!nodes[node].leaf) {
+        const int c0 = node + 1, c1 = nodes[node].child;
+        const float i0 = nodes[c0].importance(p, n), i1 = nodes[c1].importance(p, n);
+        if (i0 == 0.f && i1 == 0.f)
+            return 0.f;
+        if (bits & 1) {
+            prob *= 1.f - i0 / (i0 + i1);
+            node = c1;
+        }
+        else {
+            prob *= i0 / (i0 + i1);
+            node = c0;
+        }
+        bits >>= 1;
+    }
+    return prob;
+}
@@ -0,0 +1,80 @@
+#ifndef LIGHTBVH_H
+#define LIGHTBVH_H
+
+#include <vector>
+#include <stdint.h>
+#include "light.hpp"
+#include "BB.hpp"
+#include "vector.hpp"
+
+// What a set of lights looks like from afar: where they are, how much they
+// emit and in which directions. The emitting normals lie within theta_o of
+// the axis w, and each emits up to theta_e away from its normal (pi/2 for
+// area lights). See Conty Estevez and Kulla, "Importance Sampling of Many
+// Lights with Adaptive Tree Splitting" (2018) and pbrt book (4th ed.),
+// sec 12.6.3.
+struct LightBounds {
+    BB bounds;
+    Vector w;
+    float phi;                      // emitted power, 0 for an empty set
+    float cosTheta_o, cosTheta_e;
+
+    LightBounds(): w(0.f, 0.f, 1.f), phi(0.f), cosTheta_o(1.f), cosTheta_e(1.f) {}
+    // bounds of a and b together
+    static LightBounds merge(const LightBounds &a, const LightBounds &b);
+};
+
+// Node of the tree, in depth first order like LinearBVHNode: the first
+// child of an interior node is the next one in the array. Keeps what the
+// importance needs of its LightBounds, with the box as a bounding sphere.
+struct LightBVHNode {
+    Point center;
+    float radius;
+    Vector w;
+    float phi, cosTheta_o, sinTheta_o, cosTheta_e;
+    int child;      // second child (interior) or light index (leaf)
+    bool leaf;
+
+    void set(const LightBounds &lb);
+    // estimate of the light of the node that reaches p, on the side of its
+    // shading normal n; conservative: 0 only if none of it can reach p
+    float importance(const Point &p, const Vector &n) const;
+};
+
+// Light BVH: the area and point lights of the scene, one per leaf, under a
+// binary tree whose nodes bound their lights with LightBounds. Sampling
+// walks down from the root, choosing each child in proportion to its
+// importance at the shading point, so lights are picked in O(log L) by
+// their estimated contribution rather than just their power. Lights that
+// cannot be bounded (the ambient light) are picked uniformly, with the same
+// probability as the whole tree.
+class LightBVH {
+private:
+    std::vector<LightBVHNode> nodes;
+    // path from the root to the leaf of each light: bit d set if the
+    // second child was taken at depth d
+    std::vector<uint64_t> lightBits;
+    std::vector<int> lightLeaf;     // -1 for lights not in the tree
+    std::vector<int> unbounded;     // ambient lights
+    int maxDepth;
+
+    int build(std::vector<std::pair<int, LightBounds> > &items, int start, int end, uint64_t bits, int depth);
+    // chance of picking one of the unbounded lights instead of the tree
+    float unboundedProbability() const;
+
+public:
+    LightBVH(): maxDepth(0) {}
+    // power of each light as computed for Scene's power distribution;
+    // lights without power are never sampled
+    void build(const std::vector<Light *> &lights, const std::vector<float> &power);
+    // pick a light for the shading point p with shading normal n, given a
+    // uniform u in [0,1[; returns its index and its probability in *pdf,
+    // or -1 if no light can reach p
+    int sample(const Point &p, const Vector &n, float u, float *pdf) const;
+    // probability that sample picks light l for p and n
+    float pdf(int l, const Point &p, const Vector &n) const;
+    int size() const { return (int)lightLeaf.size(); }
+    int depth() const { return maxDepth; }
+};
+
+#endif // LIGHTBVH_H
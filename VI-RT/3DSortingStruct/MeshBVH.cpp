@@ -0,0 +1,126 @@
+#include "MeshBVH.hpp"
+#include <float.h>
+#include <stdlib.h>
+
+MeshBVH::MeshBVH(Mesh *mesh, int splitMethod)
+{
+    // build a scene-less triangle level BVH over the mesh and keep its arrays
+    Primitive prim;
+    prim.g = mesh;
+    BVH bin(1, splitMethod, 1);
+    bin.verbose = false;
+    bin.keepTriangleOrder = true;
+    bin.build(std::vector<Primitive*>(1, &prim));
+
+    nodes = bin.nodes;
+    totalNodes = bin.totalNodes;
+    bin.nodes = nullptr;
+    bin.totalNodes = 0;
+    orderedTriangles = std::move(bin.orderedTriangles);
+    faces = std::move(bin.triangleOrder);
+}
+
+MeshBVH::~MeshBVH()
+{
+    free(nodes);
+}
+
+size_t MeshBVH::memory() const
+{
+    return totalNodes * sizeof(LinearBVHNode) + orderedTriangles.memory() + faces.size() * sizeof(uint32_t);
+}
+
+bool MeshBVH::trace(const Ray &r, Intersection *isect)
+{
+    TriangleHit hit;
+    if (!closestHit(r, &hit))
+        return false;
+    orderedTriangles.fillHit(hit, r, isect);
+    return true;
+}
+
+bool MeshBVH::trace(const Ray &r, TriangleHit *hit)
+{
+    if (!closestHit(r, hit))
+        return false;
+    hit->triangle = faces[hit->triangle];
+    return true;
+}
+
+// same front to back traversal as BVH::trace
+bool MeshBVH::closestHit(const Ray &r, TriangleHit *hit)
+{
+    if (totalNodes == 0) return false;
+
+    int toVisit[BVH_STACK_SIZE];
+    int toVisitOffset = 0, current = 0;
+
+    while (true)
+    {
+        const LinearBVHNode &node = nodes[current];
+        float tEnter;
+        if (node.boundingBox.intersect(r, hit->t, &tEnter))
+        {
+            if (node.nItems > 0)
+            {
+                for (int i = node.itemsOffset; i < node.itemsOffset + node.nItems; i++)
+                    orderedTriangles.intersect(i, r, hit);
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+            else if (r.sign[node.axis])
+            {
+                toVisit[toVisitOffset++] = current + 1;
+                current = node.secondChildOffset;
+            }
+            else
+            {
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisitOffset == 0) break;
+            current = toVisit[--toVisitOffset];
+        }
+    }
+    return hit->triangle >= 0;
+}
+
+bool MeshBVH::occluded(const Ray &r, float tmax)
+{
+    if (totalNodes == 0) return false;
+
+    int toVisit[BVH_STACK_SIZE];
+    int toVisitOffset = 0, current = 0;
+    TriangleHit hit(tmax);
+
+    while (true)
+    {
+        const LinearBVHNode &node = nodes[current];
+        float tEnter;
+        if (node.boundingBox.intersect(r, tmax, &tEnter))
+        {
+            if (node.nItems > 0)
+            {
+                for (int i = node.itemsOffset; i < node.itemsOffset + node.nItems; i++)
+                    if (orderedTriangles.intersect(i, r, &hit))
+                        return true;
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+            else
+            {
+                toVisit[toVisitOffset++] = node.secondChildOffset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (toVisitOffset == 0) break;
+            current = toVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
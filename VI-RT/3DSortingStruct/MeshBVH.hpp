@@ -0,0 +1,31 @@
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+#include <vector>
+#include "BVH.hpp"
+
+// Triangle level BVH over the faces of one mesh, in the mesh's own (object)
+// space: the bottom level of the two level structure, shared by all the
+// instances of the mesh (see Instance), and the mesh's own BVH when the
+// scene has no acceleration structure (see Mesh::buildBVH). Built with the
+// BVH builder, but traced without a scene: hits only carry the geometry.
+class MeshBVH {
+private:
+    LinearBVHNode *nodes;
+    int totalNodes;
+    TriangleBuffer orderedTriangles;
+    std::vector<uint32_t> faces;    // mesh face of each ordered triangle
+    // closest hit, hit->triangle is the index in orderedTriangles
+    bool closestHit(const Ray &r, TriangleHit *hit);
+
+public:
+    MeshBVH(Mesh *mesh, int splitMethod=SPLIT_SAH);
+    ~MeshBVH();
+    bool trace(const Ray &r, Intersection *isect);
+    // closest hit, hit->triangle is the mesh face
+    bool trace(const Ray &r, TriangleHit *hit);
+    bool occluded(const Ray &r, float tmax);
+    size_t memory() const;
+};
+
+#endif // MESHBVH_H
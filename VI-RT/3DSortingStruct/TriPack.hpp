@@ -0,0 +1,139 @@
+#ifndef TRIPACK_H
+#define TRIPACK_H
+
+#include <stdint.h>
+#include "ray.hpp"
+#include "TriangleBuffer.hpp"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TRIPACK_SSE 1
+#endif
+
+// 4 triangles of a leaf in SoA form (first vertex and the two edges from it,
+// [axis][lane]), so that one SSE Moller Trumbore test intersects all of them.
+// Unused lanes have zero edges and are never hit.
+struct alignas(16) TriPack4 {
+    float v0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+    int tri[4];         // triangle of each lane in the TriangleBuffer, -1 if unused
+
+    // pack triangles tris[0..n[ of buffer (n <= 4)
+    void set(const TriangleBuffer &buffer, const uint32_t *tris, int n)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            for (int a = 0; a < 3; a++)
+                v0[a][k] = e1[a][k] = e2[a][k] = 0.f;
+            tri[k] = -1;
+            if (k >= n) continue;
+            Point p0 = buffer.vertex(tris[k], 0);
+            const Vector d1 = p0.vec2point(buffer.vertex(tris[k], 1));
+            const Vector d2 = p0.vec2point(buffer.vertex(tris[k], 2));
+            const float p[3] = { p0.X, p0.Y, p0.Z }, q1[3] = { d1.X, d1.Y, d1.Z }, q2[3] = { d2.X, d2.Y, d2.Z };
+            for (int a = 0; a < 3; a++)
+            {
+                v0[a][k] = p[a];
+                e1[a][k] = q1[a];
+                e2[a][k] = q2[a];
+            }
+            tri[k] = (int)tris[k];
+        }
+    }
+};
+
+#ifdef TRIPACK_SSE
+
+// Intersect r with the 4 triangles of a pack: returns a bit mask of the lanes
+// hit at a distance in ]EPSILON, tmax[, their distances in t and the
+// barycentric coordinates of the hits in u, v
+static inline int intersectTriPack4(const TriPack4 &p, const Ray &r, float tmax, float t[4], float u[4], float v[4])
+{
+    const __m128 dx = _mm_set1_ps(r.dir.X), dy = _mm_set1_ps(r.dir.Y), dz = _mm_set1_ps(r.dir.Z);
+    const __m128 e1x = _mm_load_ps(p.e1[0]), e1y = _mm_load_ps(p.e1[1]), e1z = _mm_load_ps(p.e1[2]);
+    const __m128 e2x = _mm_load_ps(p.e2[0]), e2y = _mm_load_ps(p.e2[1]), e2z = _mm_load_ps(p.e2[2]);
+
+    // pvec = dir x e2, det = e1 . pvec
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 eps = _mm_set1_ps(EPSILON);
+    __m128 valid = _mm_or_ps(_mm_cmpgt_ps(det, eps), _mm_cmplt_ps(det, _mm_sub_ps(_mm_setzero_ps(), eps)));
+    if (!_mm_movemask_ps(valid)) return 0;
+    const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+    // s = o - v0, u = (s . pvec) / det
+    const __m128 sx = _mm_sub_ps(_mm_set1_ps(r.o.X), _mm_load_ps(p.v0[0]));
+    const __m128 sy = _mm_sub_ps(_mm_set1_ps(r.o.Y), _mm_load_ps(p.v0[1]));
+    const __m128 sz = _mm_sub_ps(_mm_set1_ps(r.o.Z), _mm_load_ps(p.v0[2]));
+    const __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)),
+                                 invDet);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+
+    // q = s x e1, v = (dir . q) / det, t = (e2 . q) / det
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    const __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)),
+                                 invDet);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+    const __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                                            _mm_mul_ps(e2z, qz)), invDet);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tt, eps), _mm_cmplt_ps(tt, _mm_set1_ps(tmax))));
+
+    _mm_storeu_ps(t, tt);
+    _mm_storeu_ps(u, uu);
+    _mm_storeu_ps(v, vv);
+    return _mm_movemask_ps(valid);
+}
+
+#else
+
+static inline int intersectTriPack4(const TriPack4 &p, const Ray &r, float tmax, float t[4], float u[4], float v[4])
+{
+    const float d[3] = { r.dir.X, r.dir.Y, r.dir.Z }, o[3] = { r.o.X, r.o.Y, r.o.Z };
+    int mask = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        const float e1[3] = { p.e1[0][k], p.e1[1][k], p.e1[2][k] };
+        const float e2[3] = { p.e2[0][k], p.e2[1][k], p.e2[2][k] };
+        const float pv[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+        const float det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+        if (det > -EPSILON && det < EPSILON) continue;
+        const float invDet = 1.f / det;
+        const float s[3] = { o[0] - p.v0[0][k], o[1] - p.v0[1][k], o[2] - p.v0[2][k] };
+        u[k] = (s[0] * pv[0] + s[1] * pv[1] + s[2] * pv[2]) * invDet;
+        if (u[k] < 0.f || u[k] > 1.f) continue;
+        const float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+        v[k] = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+        if (v[k] < 0.f || u[k] + v[k] > 1.f) continue;
+        t[k] = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+        if (t[k] > EPSILON && t[k] < tmax) mask |= 1 << k;
+    }
+    return mask;
+}
+
+#endif
+
+// closest hit of r on the pack, recorded in hit if closer than hit->t
+static inline bool intersectTriPack4(const TriPack4 &p, const Ray &r, TriangleHit *hit)
+{
+    float t[4], u[4], v[4];
+    const int mask = intersectTriPack4(p, r, hit->t, t, u, v);
+    for (int k = 0; k < 4; k++)
+    {
+        if ((mask & (1 << k)) && t[k] < hit->t)
+        {
+            hit->t = t[k];
+            hit->u = u[k];
+            hit->v = v[k];
+            hit->triangle = p.tri[k];
+        }
+    }
+    return mask != 0;
+}
+
+#endif // TRIPACK_H
@@ -0,0 +1,179 @@
+#include "TriangleBuffer.hpp"
+#include "mesh.hpp"
+#include "instance.hpp"
+#include <algorithm>
+
+void TriangleBuffer::clear()
+{
+    vertices.clear();
+    indices.clear();
+    sources.clear();
+    declaredNormals.clear();
+}
+
+size_t TriangleBuffer::add(const Geometry *g)
+{
+    const uint32_t base = (uint32_t)vertices.size();
+    const size_t first = size();
+    const Mesh *mesh = dynamic_cast<const Mesh*>(g);
+    const Instance *inst = dynamic_cast<const Instance*>(g);
+    if (inst)
+        mesh = inst->mesh;
+
+    if (mesh)
+    {
+        vertices.resize(base + mesh->vertices.size());
+        indices.reserve(indices.size() + 3 * mesh->faces.size());
+        for (const Face &face : mesh->faces)
+            for (int k = 0; k < 3; k++)
+                indices.push_back(base + face.vert_ndx[k]);
+    }
+    else if (const Triangle *tri = dynamic_cast<const Triangle*>(g))
+    {
+        vertices.resize(base + 3);
+        for (int k = 0; k < 3; k++)
+            indices.push_back(base + k);
+        declaredNormals.push_back(std::make_pair(base, tri));
+    }
+    else
+        return 0;
+
+    sources.push_back({ g, base });
+    copyVertices(sources.back());
+    return size() - first;
+}
+
+void TriangleBuffer::copyVertices(const Source &s)
+{
+    Point *dst = &vertices[s.firstVertex];
+    if (const Instance *inst = dynamic_cast<const Instance*>(s.g))
+    {
+        for (const Point &v : inst->mesh->vertices)
+            *dst++ = inst->toWorld.point(v);
+    }
+    else if (const Mesh *mesh = dynamic_cast<const Mesh*>(s.g))
+    {
+        for (const Point &v : mesh->vertices)
+            *dst++ = v;
+    }
+    else
+    {
+        const Triangle *tri = (const Triangle*)s.g;
+        dst[0] = tri->v1;
+        dst[1] = tri->v2;
+        dst[2] = tri->v3;
+    }
+}
+
+void TriangleBuffer::updateVertices()
+{
+    for (const Source &s : sources)
+        copyVertices(s);
+}
+
+void TriangleBuffer::reorder(const std::vector<uint32_t> &order)
+{
+    std::vector<uint32_t> reordered(3 * order.size());
+    for (size_t i = 0; i < order.size(); i++)
+        for (int k = 0; k < 3; k++)
+            reordered[3 * i + k] = indices[3 * order[i] + k];
+    indices.swap(reordered);
+}
+
+BB TriangleBuffer::bounds(uint32_t t) const
+{
+    BB bb;
+    bb.min = bb.max = vertex(t, 0);
+    bb.update(vertex(t, 1));
+    bb.update(vertex(t, 2));
+    return bb;
+}
+
+Point TriangleBuffer::centroid(uint32_t t) const
+{
+    return (vertex(t, 0) + vertex(t, 1) + vertex(t, 2)) / 3.0f;
+}
+
+Triangle TriangleBuffer::triangle(uint32_t t) const
+{
+    Point v1 = vertex(t, 0), v2 = vertex(t, 1), v3 = vertex(t, 2);
+    Vector normal = v1.vec2point(v2).cross(v1.vec2point(v3));
+    normal.normalize();
+    return Triangle(v1, v2, v3, normal);
+}
+
+// see Triangle::intersect; the box test is left to the accelerator nodes
+bool TriangleBuffer::intersect(uint32_t t, const Ray &r, TriangleHit *hit) const
+{
+    Point v1 = vertex(t, 0);
+    const Vector edge1 = v1.vec2point(vertex(t, 1));
+    const Vector edge2 = v1.vec2point(vertex(t, 2));
+
+    Vector ray_cross_e2 = r.dir.cross(edge2);
+    float det = edge1.dot(ray_cross_e2);
+
+    if (det > -EPSILON && det < EPSILON)
+        return false;
+
+    float inv_det = 1.0 / det;
+    Vector s = v1.vec2point(r.o);
+    float u = inv_det * s.dot(ray_cross_e2);
+
+    if (u < 0 || u > 1)
+        return false;
+
+    Vector s_cross_e1 = s.cross(edge1);
+    float v = inv_det * r.dir.dot(s_cross_e1);
+
+    if (v < 0 || u + v > 1)
+        return false;
+
+    float depth = inv_det * edge2.dot(s_cross_e1);
+    if (depth <= EPSILON || depth >= hit->t)
+        return false;
+
+    hit->t = depth;
+    hit->u = u;
+    hit->v = v;
+    hit->triangle = (int)t;
+    return true;
+}
+
+const Triangle *TriangleBuffer::declaredNormalSource(uint32_t t) const
+{
+    if (declaredNormals.empty())
+        return NULL;
+    const uint32_t first = indices[3 * t];
+    auto it = std::lower_bound(declaredNormals.begin(), declaredNormals.end(),
+                               std::make_pair(first, (const Triangle*)NULL));
+    return (it != declaredNormals.end() && it->first == first) ? it->second : NULL;
+}
+
+void TriangleBuffer::fillHit(const TriangleHit &hit, const Ray &r, Intersection *isect) const
+{
+    // as Triangle::intersect for the area lights, otherwise the same
+    // normal as Mesh faces get when loaded
+    Vector normal;
+    if (const Triangle *tri = declaredNormalSource(hit.triangle))
+        normal = tri->normal;
+    else {
+        Point v1 = vertex(hit.triangle, 0);
+        normal = v1.vec2point(vertex(hit.triangle, 1)).cross(v1.vec2point(vertex(hit.triangle, 2)));
+        normal.normalize();
+    }
+    Vector wo = -1.f * r.dir;
+    isect->gn = normal;
+    isect->sn = normal;
+    isect->p = r.o + r.dir * hit.t;
+    isect->wo = wo;
+    isect->FaceID = -1;
+    isect->u = hit.u;
+    isect->v = hit.v;
+    isect->isLight = false;
+    isect->depth = hit.t;
+}
+
+size_t TriangleBuffer::memory() const
+{
+    return vertices.size() * sizeof(Point) + indices.size() * sizeof(uint32_t);
+}
@@ -0,0 +1,58 @@
+#ifndef TRIANGLEBUFFER_H
+#define TRIANGLEBUFFER_H
+
+#include <vector>
+#include <stdint.h>
+#include "ray.hpp"
+#include "intersection.hpp"
+#include "BB.hpp"
+#include "geometry.hpp"
+#include "triangle.hpp"
+
+// Triangles traced by the accelerators, stored compactly: the vertices of
+// each geometry are copied once (in world space) into a shared buffer and a
+// triangle is 3 32 bit indices into it, 12 bytes instead of a Triangle
+// object (see pbrt book (3rd ed.), sec 3.6). The edges and the normal are
+// computed from the vertices by the intersection test, except for the
+// normal of a Triangle, which is its own.
+class TriangleBuffer {
+public:
+    std::vector<Point> vertices;
+    std::vector<uint32_t> indices;      // 3 per triangle
+
+    size_t size() const { return indices.size() / 3; }
+    void clear();
+    // append the triangles of a mesh, of an instance (in world space) or a
+    // triangle (area light); returns how many were added
+    size_t add(const Geometry *g);
+    // copy the current vertices of the added geometries again (refit)
+    void updateVertices();
+    // keep the triangles order[0..n[, in that order; the vertices are not touched
+    void reorder(const std::vector<uint32_t> &order);
+
+    const Point &vertex(uint32_t t, int k) const { return vertices[indices[3 * t + k]]; }
+    BB bounds(uint32_t t) const;
+    Point centroid(uint32_t t) const;
+    Triangle triangle(uint32_t t) const;
+    // Moller Trumbore test of triangle t: records the hit in hit and returns
+    // true if it is closer than hit->t
+    bool intersect(uint32_t t, const Ray &r, TriangleHit *hit) const;
+    // geometry of a hit of r, as Triangle::intersect fills it
+    void fillHit(const TriangleHit &hit, const Ray &r, Intersection *isect) const;
+    size_t memory() const;
+
+private:
+    // where the vertices of each added geometry start, to update them
+    struct Source {
+        const Geometry *g;
+        uint32_t firstVertex;
+    };
+    std::vector<Source> sources;
+    void copyVertices(const Source &s);
+    // Triangle sources (area lights) keep the normal they were given, which
+    // need not follow their winding: their first vertex, in increasing order
+    std::vector<std::pair<uint32_t, const Triangle*> > declaredNormals;
+    const Triangle *declaredNormalSource(uint32_t t) const;
+};
+
+#endif // TRIANGLEBUFFER_H
@@ -0,0 +1,234 @@
+#include "UniformGrid.hpp"
+#include "scene.hpp"
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+
+// cells along each axis are limited to this many
+const int GRID_MAX_RES = 256;
+
+void UniformGrid::build(Scene *scene)
+{
+    this->scene = scene;
+    triangles.clear();
+    trianglePrim.clear();
+    cellStart.clear();
+    cellItems.clear();
+    res[0] = res[1] = res[2] = 0;
+
+    // meshes, instances (in world space) and area lights
+    for (auto prim : getPrimitives(scene))
+        trianglePrim.insert(trianglePrim.end(), triangles.add(prim->g), prim);
+    if (trianglePrim.empty())
+        return;
+
+    bounds = triangles.bounds(0);
+    for (uint32_t t = 1; t < (uint32_t)triangles.size(); t++)
+        bounds.update(triangles.bounds(t));
+    // pad the bounds, so that flat scenes have some volume and triangles on
+    // the boundary are inside
+    Vector ext = bounds.min.vec2point(bounds.max);
+    const float pad = 1e-4f * std::max(ext.X, std::max(ext.Y, ext.Z)) + 1e-6f;
+    bounds.min = Point(bounds.min.X - pad, bounds.min.Y - pad, bounds.min.Z - pad);
+    bounds.max = Point(bounds.max.X + pad, bounds.max.Y + pad, bounds.max.Z + pad);
+    ext = bounds.min.vec2point(bounds.max);
+
+    // cubic cells: lambda * N of them fill the volume
+    const float extent[3] = { ext.X, ext.Y, ext.Z };
+    const float side = cbrtf(extent[0] * extent[1] * extent[2] / (lambda * triangles.size()));
+    for (int a = 0; a < 3; a++)
+    {
+        res[a] = std::max(1, std::min(GRID_MAX_RES, (int)roundf(extent[a] / side)));
+        cellSize[a] = extent[a] / res[a];
+        invCellSize[a] = 1.f / cellSize[a];
+    }
+    const int nCells = res[0] * res[1] * res[2];
+
+    // (cell, triangle) pairs: the cells overlapped by the triangle's box,
+    // keeping those that the triangle itself overlaps
+    std::vector<std::pair<int, int> > refs;
+    const float bmin[3] = { bounds.min.X, bounds.min.Y, bounds.min.Z };
+    for (int t = 0; t < (int)triangles.size(); t++)
+    {
+        const BB bb = triangles.bounds(t);
+        const float lo[3] = { bb.min.X, bb.min.Y, bb.min.Z }, hi[3] = { bb.max.X, bb.max.Y, bb.max.Z };
+        int c0[3], c1[3];
+        for (int a = 0; a < 3; a++)
+        {
+            c0[a] = std::max(0, std::min(res[a] - 1, (int)((lo[a] - bmin[a]) * invCellSize[a])));
+            c1[a] = std::max(0, std::min(res[a] - 1, (int)((hi[a] - bmin[a]) * invCellSize[a])));
+        }
+        const bool single = c0[0] == c1[0] && c0[1] == c1[1] && c0[2] == c1[2];
+        const Triangle tri = triangles.triangle(t);
+        for (int z = c0[2]; z <= c1[2]; z++)
+            for (int y = c0[1]; y <= c1[1]; y++)
+                for (int x = c0[0]; x <= c1[0]; x++)
+                    if (single || tri.intersects(cellBounds(x, y, z)))
+                        refs.push_back(std::make_pair(cellIndex(x, y, z), t));
+    }
+
+    // counting sort of the pairs by cell
+    cellStart.assign(nCells + 1, 0);
+    for (const auto &ref : refs)
+        cellStart[ref.first + 1]++;
+    for (int c = 0; c < nCells; c++)
+        cellStart[c + 1] += cellStart[c];
+    cellItems.resize(refs.size());
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (const auto &ref : refs)
+        cellItems[fill[ref.first]++] = ref.second;
+
+    int empty = 0;
+    for (int c = 0; c < nCells; c++)
+        empty += (cellStart[c] == cellStart[c + 1]);
+    if (verbose)
+        printf("UniformGrid: %dx%dx%d cells (%.0f%% empty), %.2f references per triangle, %.1lf KB\n",
+               res[0], res[1], res[2], 100.f * empty / nCells, (float)refs.size() / triangles.size(),
+               (cellStart.size() * sizeof(int) + cellItems.size() * sizeof(int) +
+                triangles.memory() + trianglePrim.size() * sizeof(Primitive *)) / 1024.);
+}
+
+// box of a cell, slightly enlarged so that the triangle overlap test is conservative
+BB UniformGrid::cellBounds(int x, int y, int z) const
+{
+    const float eps = 1e-4f;
+    BB box;
+    box.min = Point(bounds.min.X + (x - eps) * cellSize[0], bounds.min.Y + (y - eps) * cellSize[1],
+                    bounds.min.Z + (z - eps) * cellSize[2]);
+    box.max = Point(bounds.min.X + (x + 1 + eps) * cellSize[0], bounds.min.Y + (y + 1 + eps) * cellSize[1],
+                    bounds.min.Z + (z + 1 + eps) * cellSize[2]);
+    return box;
+}
+
+// slab test, NaN tolerant like BB::intersect
+bool UniformGrid::clip(const Ray &r, float tmax, float *t0, float *t1) const
+{
+    const float o[3] = { r.o.X, r.o.Y, r.o.Z }, inv[3] = { r.invDir.X, r.invDir.Y, r.invDir.Z };
+    const float lo[3] = { bounds.min.X, bounds.min.Y, bounds.min.Z };
+    const float hi[3] = { bounds.max.X, bounds.max.Y, bounds.max.Z };
+    float tEnter = 0.f, tExit = tmax;
+    for (int a = 0; a < 3; a++)
+    {
+        const float tNear = ((r.sign[a] ? hi[a] : lo[a]) - o[a]) * inv[a];
+        const float tFar = ((r.sign[a] ? lo[a] : hi[a]) - o[a]) * inv[a];
+        if (tNear > tEnter) tEnter = tNear;
+        if (tFar < tExit) tExit = tFar;
+    }
+    if (tEnter > tExit)
+        return false;
+    *t0 = tEnter;
+    *t1 = tExit;
+    return true;
+}
+
+// 3D-DDA state of a ray walking the cells (Amanatides and Woo, 1987)
+struct GridWalk {
+    int cell[3], step[3], out[3];
+    float tNext[3];     // distance at which the ray crosses the next cell boundary along each axis
+    float tDelta[3];    // distance between two crossings along each axis
+
+    // axis of the next boundary crossed
+    int nextAxis() const
+    {
+        return (tNext[0] < tNext[1]) ? ((tNext[0] < tNext[2]) ? 0 : 2) : ((tNext[1] < tNext[2]) ? 1 : 2);
+    }
+};
+
+static void startWalk(GridWalk &w, const Ray &r, float t0, const BB &bounds, const int res[3],
+                      const float cellSize[3], const float invCellSize[3])
+{
+    const float o[3] = { r.o.X, r.o.Y, r.o.Z }, d[3] = { r.dir.X, r.dir.Y, r.dir.Z };
+    const float inv[3] = { r.invDir.X, r.invDir.Y, r.invDir.Z };
+    const float bmin[3] = { bounds.min.X, bounds.min.Y, bounds.min.Z };
+    for (int a = 0; a < 3; a++)
+    {
+        const float p = o[a] + t0 * d[a];
+        w.cell[a] = std::max(0, std::min(res[a] - 1, (int)((p - bmin[a]) * invCellSize[a])));
+        if (d[a] > 0.f)
+        {
+            w.step[a] = 1;
+            w.out[a] = res[a];
+            w.tNext[a] = t0 + (bmin[a] + (w.cell[a] + 1) * cellSize[a] - p) * inv[a];
+            w.tDelta[a] = cellSize[a] * inv[a];
+        }
+        else if (d[a] < 0.f)
+        {
+            w.step[a] = -1;
+            w.out[a] = -1;
+            w.tNext[a] = t0 + (bmin[a] + w.cell[a] * cellSize[a] - p) * inv[a];
+            w.tDelta[a] = -cellSize[a] * inv[a];
+        }
+        else
+        { // never crosses a boundary along this axis
+            w.step[a] = 0;
+            w.out[a] = -1;
+            w.tNext[a] = INFINITY;
+            w.tDelta[a] = INFINITY;
+        }
+    }
+}
+
+bool UniformGrid::trace(const Ray &r, Intersection *isect)
+{
+    float t0, t1;
+    if (res[0] == 0 || !clip(r, FLT_MAX, &t0, &t1))
+        return false;
+
+    GridWalk w;
+    startWalk(w, r, t0, bounds, res, cellSize, invCellSize);
+    TriangleHit hit;
+
+    while (true)
+    {
+        const int c = cellIndex(w.cell[0], w.cell[1], w.cell[2]);
+        for (int i = cellStart[c]; i < cellStart[c + 1]; i++)
+            triangles.intersect(cellItems[i], r, &hit);
+
+        const int a = w.nextAxis();
+        // no triangle of the cells further away can be closer than a hit
+        // before the exit of this one
+        if (hit.t <= w.tNext[a])
+            break;
+        w.cell[a] += w.step[a];
+        if (w.cell[a] == w.out[a])
+            break;
+        w.tNext[a] += w.tDelta[a];
+    }
+    if (hit.triangle < 0)
+        return false;
+    triangles.fillHit(hit, r, isect);
+    setHitInfo(trianglePrim[hit.triangle], isect);
+    return true;
+}
+
+// any hit query: lights do not cast shadows (see BVH::occluded)
+bool UniformGrid::occluded(const Ray &r, float tmax)
+{
+    float t0, t1;
+    if (res[0] == 0 || !clip(r, tmax, &t0, &t1))
+        return false;
+
+    GridWalk w;
+    startWalk(w, r, t0, bounds, res, cellSize, invCellSize);
+    TriangleHit hit(tmax);
+
+    while (true)
+    {
+        const int c = cellIndex(w.cell[0], w.cell[1], w.cell[2]);
+        for (int i = cellStart[c]; i < cellStart[c + 1]; i++)
+        {
+            const int t = cellItems[i];
+            if (trianglePrim[t]->light_ndx < 0 && triangles.intersect(t, r, &hit))
+                return true;
+        }
+
+        const int a = w.nextAxis();
+        if (w.tNext[a] >= tmax)
+            break;
+        w.cell[a] += w.step[a];
+        if (w.cell[a] == w.out[a])
+            break;
+        w.tNext[a] += w.tDelta[a];
+    }
+    return false;
+}
@@ -0,0 +1,42 @@
+#ifndef UNIFORMGRID_H
+#define UNIFORMGRID_H
+
+#include <vector>
+#include "AccelStruct.hpp"
+#include "ray.hpp"
+#include "intersection.hpp"
+#include "BB.hpp"
+#include "primitive.hpp"
+#include "TriangleBuffer.hpp"
+
+// Uniform grid over the scene triangles (see pbrt book (2nd ed.), sec 4.3).
+// The number of cells along each axis follows the extent of the scene, with
+// about lambda * N cells in total for N triangles (Cleary and Wyvill).
+// Each cell lists the triangles that overlap it; a ray walks the cells it
+// crosses front to back with the 3D-DDA of Amanatides and Woo and stops at
+// the first cell where it has a hit closer than the cell exit.
+class UniformGrid : public AccelStruct {
+private:
+    float lambda;
+    BB bounds;
+    int res[3];                             // cells along X, Y, Z
+    float cellSize[3], invCellSize[3];
+    // triangles of cell c are cellItems[cellStart[c] .. cellStart[c+1][
+    std::vector<int> cellStart;
+    std::vector<int> cellItems;
+    TriangleBuffer triangles;
+    std::vector<Primitive*> trianglePrim;   // primitive (material / light) of each triangle
+
+    int cellIndex(int x, int y, int z) const { return (z * res[1] + y) * res[0] + x; }
+    BB cellBounds(int x, int y, int z) const;
+    // clip the ray to the grid bounds, returns the distances of entry and exit
+    bool clip(const Ray &r, float tmax, float *t0, float *t1) const;
+
+public:
+    UniformGrid(float _lambda=4.f): lambda(_lambda) { res[0] = res[1] = res[2] = 0; }
+    void build(Scene *scene);
+    bool trace(const Ray &r, Intersection *isect);
+    bool occluded(const Ray &r, float tmax);
+};
+
+#endif // UNIFORMGRID_H
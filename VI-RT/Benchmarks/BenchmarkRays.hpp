@@ -0,0 +1,66 @@
+//
+//  BenchmarkRays.hpp
+//  VI-RT
+//
+//  Rays shared by the acceleration structure benchmarks, and the check that
+//  two structures return the same closest hits for them.
+//
+
+#ifndef BenchmarkRays_hpp
+#define BenchmarkRays_hpp
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "scene.hpp"
+#include "AccelStruct.hpp"
+#include "random.hpp"
+
+// incoherent rays, as traced by the path tracer after the first bounce:
+// random origins inside the bounds of the scene primitives, uniform
+// directions on the sphere; the same rays for the same scene and n
+static inline std::vector<Ray> randomRays (Scene *scene, size_t n, BB *sceneBounds=nullptr) {
+    std::vector<Primitive *> prims = scene->getPrims();
+    BB bounds = prims[0]->g->bb;
+    for (auto p : prims)
+        bounds.update(p->g->bb);
+    if (sceneBounds) *sceneBounds = bounds;
+    const Vector extent = bounds.min.vec2point(bounds.max);
+
+    PCG32 rng(42, 7);
+    std::vector<Ray> rays(n);
+    for (auto &r : rays) {
+        Point o(bounds.min.X + rng.uniform() * extent.X,
+                bounds.min.Y + rng.uniform() * extent.Y,
+                bounds.min.Z + rng.uniform() * extent.Z);
+        const float z = 1.f - 2.f * rng.uniform(), phi = 2.f * (float)M_PI * rng.uniform();
+        const float rxy = sqrtf(std::max(0.f, 1.f - z * z));
+        r = Ray(o, Vector(rxy * cosf(phi), rxy * sinf(phi), z));
+    }
+    return rays;
+}
+
+// closest hit distance of each ray in depths (-1 for a miss); returns the
+// seconds taken
+static inline double traceDepths (AccelStruct *accel, const std::vector<Ray> &rays, std::vector<float> *depths) {
+    depths->resize(rays.size());
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0 ; i<rays.size() ; i++) {
+        Intersection isect;
+        (*depths)[i] = accel->trace(rays[i], &isect) ? isect.depth : -1.f;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// rays hit by only one of the structures, or at distances more than 1e-4
+// apart (relative beyond 1)
+static inline long depthMismatches (const std::vector<float> &a, const std::vector<float> &b) {
+    long n = 0;
+    for (size_t i=0 ; i<a.size() ; i++)
+        if ((a[i] < 0.f) != (b[i] < 0.f) || fabsf(a[i] - b[i]) > 1e-4f * std::max(1.f, a[i]))
+            n++;
+    return n;
+}
+
+#endif /* BenchmarkRays_hpp */
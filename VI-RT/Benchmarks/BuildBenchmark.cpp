@@ -0,0 +1,69 @@
+//
+//  BuildBenchmark.cpp
+//  VI-RT
+//
+//  Construction time of the triangle level BVH with the serial builder and
+//  with the parallel (task based) one, for each split method, and the
+//  expected traversal cost of the trees. The serial and parallel trees must
+//  be the same: the parallel builder only changes which thread builds each
+//  subtree.
+//  usage: BuildBenchmark [model] [threads] [repetitions]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include "scene.hpp"
+#include "BVH.hpp"
+
+// best of reps builds
+static double timeBuild (Scene *scene, int splitMethod, int nThreads, int reps, BVHCost *cost) {
+    double best = 0.;
+    for (int r=0 ; r<reps ; r++) {
+        BVH bvh(1, splitMethod, nThreads);
+        bvh.build(scene);
+        if (r == 0 || bvh.buildTime < best) best = bvh.buildTime;
+        *cost = bvh.cost();
+    }
+    return best;
+}
+
+int main (int argc, char **argv) {
+    const char *model = argc > 1 ? argv[1] : "models/multiCornellBox_4x4.obj";
+    int nThreads = argc > 2 ? atoi(argv[2]) : 0;
+    const int reps = argc > 3 ? atoi(argv[3]) : 5;
+    if (nThreads <= 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    Scene scene(false);
+    if (!scene.Load(model)) {
+        fprintf(stderr, "cannot load %s\n", model);
+        return 1;
+    }
+
+    const int nMethods = 4;
+    const int methods[nMethods] = { SPLIT_MEDIAN, SPLIT_SAH, SPLIT_LBVH, SPLIT_HLBVH };
+    double serial[nMethods], parallel[nMethods];
+    BVHCost cost[nMethods];
+    bool same[nMethods];
+    for (int m=0 ; m<nMethods ; m++) {
+        BVHCost cs, cp;
+        serial[m] = timeBuild(&scene, methods[m], 1, reps, &cs);
+        parallel[m] = timeBuild(&scene, methods[m], nThreads, reps, &cp);
+        same[m] = cs.nodes == cp.nodes && cs.leaves == cp.leaves && cs.maxDepth == cp.maxDepth &&
+                  cs.nodeVisits == cp.nodeVisits && cs.itemTests == cp.itemTests;
+        cost[m] = cs;
+    }
+
+    printf("\n%s, best of %d builds\n", model, reps);
+    printf("         serial (ms) parallel %d thr (ms)  speedup  same tree   node visits  tri tests  vs median\n",
+           nThreads);
+    for (int m=0 ; m<nMethods ; m++) {
+        const double c = cost[m].nodeVisits + cost[m].itemTests;
+        const double c0 = cost[0].nodeVisits + cost[0].itemTests;
+        printf("%-8s %10.3f %19.3f %8.2f  %9s %13.2f %10.2f %10.2f\n", bvhSplitMethodName(methods[m]),
+               1e3 * serial[m], 1e3 * parallel[m], serial[m] / parallel[m], same[m] ? "yes" : "NO",
+               cost[m].nodeVisits, cost[m].itemTests, c / c0);
+    }
+    return 0;
+}
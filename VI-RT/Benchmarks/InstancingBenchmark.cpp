@@ -0,0 +1,117 @@
+//
+//  InstancingBenchmark.cpp
+//  VI-RT
+//
+//  Flat scene (every mesh copied into one triangle level BVH4) against the
+//  two level structure (a BVH over the instances, each tracing the shared
+//  BVH of its mesh): memory, build time, trace time and hit mismatches for
+//  a set of random rays. The model is loaded both ways, then an NxN grid of
+//  rooms is built by instancing the meshes of the model. An instance is
+//  its mesh translated in float, a rounding off the loaded copy, which
+//  grazing rays can turn into a depth mismatch (one of 100000 on the model).
+//  usage: InstancingBenchmark [model] [N]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <set>
+#include "scene.hpp"
+#include "BVH.hpp"
+#include "BVH4.hpp"
+#include "MeshBVH.hpp"
+#include "instance.hpp"
+#include "BenchmarkRays.hpp"
+
+static size_t flatMemory (Scene *scene) {
+    size_t bytes = 0;
+    for (auto p : scene->getPrims()) {
+        Mesh *m = dynamic_cast<Mesh *>(p->g);
+        if (m) bytes += m->numVertices * sizeof(Point) + m->numFaces * sizeof(Face);
+    }
+    return bytes;
+}
+
+// the instances, and once each mesh with its BVH
+static size_t instancedMemory (Scene *scene, int *unique) {
+    std::set<Mesh *> meshes;
+    size_t bytes = 0;
+    for (auto p : scene->getPrims()) {
+        Instance *inst = dynamic_cast<Instance *>(p->g);
+        if (!inst) continue;
+        bytes += sizeof(Instance);
+        if (meshes.insert(inst->mesh).second)
+            bytes += inst->mesh->numVertices * sizeof(Point) + inst->mesh->numFaces * sizeof(Face) +
+                     inst->blas->memory();
+    }
+    *unique = (int)meshes.size();
+    return bytes;
+}
+
+static void compare (const char *name, Scene *flat, Scene *instanced, int nRays) {
+    BVH4 flatBVH(SPLIT_SAH);
+    BVH tlas(0, SPLIT_SAH);
+    flatBVH.verbose = tlas.verbose = false;
+    auto start = std::chrono::steady_clock::now();
+    flatBVH.build(flat);
+    auto mid = std::chrono::steady_clock::now();
+    tlas.build(instanced);
+    auto end = std::chrono::steady_clock::now();
+    const double bf = std::chrono::duration<double>(mid - start).count();
+    const double bi = std::chrono::duration<double>(end - mid).count();
+
+    const std::vector<Ray> rays = randomRays(flat, nRays);
+    std::vector<float> df, di;
+    const double tf = traceDepths(&flatBVH, rays, &df);
+    const double ti = traceDepths(&tlas, rays, &di);
+    const long wrong = depthMismatches(df, di);
+
+    int unique;
+    const size_t instancedBytes = instancedMemory(instanced, &unique);
+    printf("%-10s %8d %8d %12.1f %14.1f %10.3f %10.3f %12.2f %10.2f %10ld\n", name, flat->numPrimitives,
+           unique, flatMemory(flat) / 1024., instancedBytes / 1024.,
+           1e3 * bf, 1e3 * bi, 1e9 * tf / rays.size(), 1e9 * ti / rays.size(), wrong);
+}
+
+int main (int argc, char **argv) {
+    const char *model = argc > 1 ? argv[1] : "models/multiCornellBox_4x4.obj";
+    const int N = argc > 2 ? atoi(argv[2]) : 8;
+    const int nRays = 100000;
+
+    Scene flat(false), instanced(false);
+    if (!flat.Load(model) || !instanced.Load(model, true)) {
+        fprintf(stderr, "cannot load %s\n", model);
+        return 1;
+    }
+    printf("                meshes   unique  flat mem KB  instanced KB  build ms  tlas ms  flat ns/ray  inst ns/ray  mismatches\n");
+    compare("model", &flat, &instanced, nRays);
+
+    // NxN rooms, the model being room (0,0): the flat scene copies the
+    // vertices of the model's meshes, the instanced one places them
+    Scene flatRooms(false), instancedRooms(false);
+    flatRooms.Load(model);
+    instancedRooms.Load(model, true);
+    const std::vector<Primitive *> room = instancedRooms.getPrims();
+    for (int i=0 ; i<N ; i++) {
+        for (int j=0 ; j<N ; j++) {
+            if (i == 0 && j == 0) continue;
+            const Vector offset(i * 28.f, j * 27.9f, 0.f);
+            for (auto p : room) {
+                Instance *inst = (Instance *)p->g;
+                Mesh *copy = new Mesh(*inst->mesh);
+                const Transform toWorld = Transform::translate(offset) * inst->toWorld;
+                for (auto &v : copy->vertices)
+                    v = toWorld.point(v);
+                copy->updateGeometry();
+                instancedRooms.AddInstance(inst->mesh, p->material_ndx, toWorld);
+                flatRooms.AddMesh(copy, p->material_ndx);
+            }
+        }
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%dx%d rooms", N, N);
+    compare(name, &flatRooms, &instancedRooms, nRays);
+    return 0;
+}
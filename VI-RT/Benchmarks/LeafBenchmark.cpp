@@ -0,0 +1,101 @@
+//
+//  LeafBenchmark.cpp
+//  VI-RT
+//
+//  Leaf stage of the traversal in isolation: closest hit of a ray against a
+//  leaf of n triangles, tested one at a time (TriangleBuffer::intersect, as
+//  the binary BVH does) or 4 at a time in SoA packs (TriPack4, as BVH4 does).
+//  The triangles are random, in a unit box, and the rays cross the box, so
+//  that most leaves have hits. Both must find the same closest triangle.
+//  usage: LeafBenchmark [rays] [leaves]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "TriangleBuffer.hpp"
+#include "TriPack.hpp"
+#include "random.hpp"
+
+static Point randomPoint (PCG32 &rng) {
+    return Point(rng.uniform(), rng.uniform(), rng.uniform());
+}
+
+int main (int argc, char **argv) {
+    const int nRays = argc > 1 ? atoi(argv[1]) : 20000;
+    const int nLeaves = argc > 2 ? atoi(argv[2]) : 64;
+    PCG32 rng(42, 7);
+
+    std::vector<Ray> rays(nRays);
+    for (auto &r : rays) {
+        Point o = randomPoint(rng), target = randomPoint(rng);
+        o = Point(o.X * 3.f - 1.f, o.Y * 3.f - 1.f, -1.f);
+        Vector d = o.vec2point(target);
+        d.normalize();
+        r = Ray(o, d);
+    }
+
+    printf("%d rays x %d leaves\n", nRays, nLeaves);
+    printf("leaf size   scalar ns/leaf   packed ns/leaf   speedup   mismatches\n");
+    const int sizes[] = { 1, 2, 4, 8, 12, 16, 20 };
+    for (int n : sizes) {
+        // leaves of n small triangles around a random point of the box
+        TriangleBuffer buffer;
+        std::vector<Triangle> tris;
+        for (int i=0 ; i<nLeaves * n ; i++) {
+            const Point c = randomPoint(rng);
+            Point v[3];
+            for (int k=0 ; k<3 ; k++)
+                v[k] = Point(c.X + 0.3f * (rng.uniform() - 0.5f), c.Y + 0.3f * (rng.uniform() - 0.5f),
+                             c.Z + 0.3f * (rng.uniform() - 0.5f));
+            tris.push_back(Triangle(v[0], v[1], v[2], Vector(0.f, 0.f, 1.f)));
+        }
+        for (const Triangle &t : tris)
+            buffer.add(&t);
+
+        const int packsPerLeaf = (n + 3) / 4;
+        std::vector<TriPack4> packs(nLeaves * packsPerLeaf);
+        for (int l=0 ; l<nLeaves ; l++) {
+            for (int p=0 ; p<packsPerLeaf ; p++) {
+                uint32_t idx[4];
+                const int count = std::min(4, n - 4 * p);
+                for (int k=0 ; k<count ; k++)
+                    idx[k] = (uint32_t)(l * n + 4 * p + k);
+                packs[l * packsPerLeaf + p].set(buffer, idx, count);
+            }
+        }
+
+        std::vector<int> scalarHit(nRays * nLeaves), packedHit(nRays * nLeaves);
+        auto start = std::chrono::steady_clock::now();
+        for (int r=0 ; r<nRays ; r++) {
+            for (int l=0 ; l<nLeaves ; l++) {
+                TriangleHit hit;
+                for (int i=l * n ; i<(l + 1) * n ; i++)
+                    buffer.intersect(i, rays[r], &hit);
+                scalarHit[r * nLeaves + l] = hit.triangle;
+            }
+        }
+        auto mid = std::chrono::steady_clock::now();
+        for (int r=0 ; r<nRays ; r++) {
+            for (int l=0 ; l<nLeaves ; l++) {
+                TriangleHit hit;
+                for (int p=l * packsPerLeaf ; p<(l + 1) * packsPerLeaf ; p++)
+                    intersectTriPack4(packs[p], rays[r], &hit);
+                packedHit[r * nLeaves + l] = hit.triangle;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        int wrong = 0;
+        for (size_t i=0 ; i<scalarHit.size() ; i++)
+            wrong += scalarHit[i] != packedHit[i];
+        const double scalar = std::chrono::duration<double>(mid - start).count();
+        const double packed = std::chrono::duration<double>(end - mid).count();
+        const double leaves = (double)nRays * nLeaves;
+        printf("%9d %16.2f %16.2f %9.2f %12d\n", n, 1e9 * scalar / leaves, 1e9 * packed / leaves,
+               scalar / packed, wrong);
+    }
+    return 0;
+}
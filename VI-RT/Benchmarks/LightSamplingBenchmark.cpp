@@ -0,0 +1,150 @@
+//
+//  LightSamplingBenchmark.cpp
+//  VI-RT
+//
+//  Noise of the direct light sampling strategies as the number of lights
+//  grows. An NxN grid of rooms is built from the model (as in main.cpp,
+//  the model holds 2x2 rooms, copied to fill the grid), each room lit by
+//  two ceiling triangles of a random power. The camera looks at the same
+//  2x2 rooms for every N, so a strategy that scales keeps their noise as
+//  the lights of the other rooms are added. The images are rendered with
+//  the MIS path tracer and compared against one with many more samples,
+//  sampled by power so that a bias of the light BVH would show; the error
+//  is the mean absolute difference relative to the mean of the reference
+//  (RMSE is dominated by the edges of the visible lights), and the bias the
+//  difference of the image means relative to the reference's.
+//  usage: LightSamplingBenchmark [model] [max N] [spp] [reference spp]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "scene.hpp"
+#include "perspective.hpp"
+#include "StandardRenderer.hpp"
+#include "ImagePPM.hpp"
+#include "PathTracerShader.hpp"
+#include "AreaLight.hpp"
+#include "random.hpp"
+
+const float ROOM_W = 28.f, ROOM_H = 27.9f;
+const int IMAGE_SIZE = 64;
+
+// NxN rooms: the model's rooms are (0..1, 0..1), the others copy room
+// (0,0), the meshes of the model with x <= 0 and y <= ROOM_H
+static bool buildRooms (Scene *scene, const char *model, int N) {
+    if (!scene->Load(model))
+        return false;
+    std::vector<Primitive *> room;
+    for (auto p : scene->getPrims())
+        if (p->g->bb.max.X <= 0.5f && p->g->bb.max.Y <= ROOM_H + 0.5f)
+            room.push_back(p);
+    for (int i=0 ; i<N ; i++) {
+        for (int j=0 ; j<N ; j++) {
+            if (i < 2 && j < 2) continue;
+            const Vector offset(i * ROOM_W, j * ROOM_H, 0.f);
+            for (auto p : room) {
+                Mesh *copy = new Mesh(*(Mesh *)p->g);
+                for (auto &v : copy->vertices)
+                    v = v + offset;
+                copy->updateGeometry();
+                scene->AddMesh(copy, p->material_ndx);
+            }
+        }
+    }
+
+    // two triangles on each ceiling, radiance from 0.25 to 4; the random
+    // stream depends on the room only, so rooms keep their lights as N grows
+    for (int i=0 ; i<N ; i++) {
+        for (int j=0 ; j<N ; j++) {
+            PCG32 rng(42, (uint64_t)(i * 4096 + j));
+            const float x = -ROOM_W + 10.f + i * ROOM_W, y = (j + 1) * ROOM_H, z = 10.f;
+            const float P = 0.25f * powf(16.f, rng.uniform());
+            scene->lights.push_back(new AreaLight(RGB(P, P, P), Point(x, y, z), Point(x, y, z+8),
+                                                  Point(x+8, y, z+8), Vector(0, -1, 0)));
+            scene->lights.push_back(new AreaLight(RGB(P, P, P), Point(x, y, z), Point(x+8, y, z+8),
+                                                  Point(x+8, y, z), Vector(0, -1, 0)));
+            scene->numLights += 2;
+        }
+    }
+    scene->BuildAccelStruct();
+    return true;
+}
+
+static std::vector<RGB> render (Scene *scene, Camera *cam, int spp, uint64_t seed, double *secs) {
+    ImagePPM img(IMAGE_SIZE, IMAGE_SIZE);
+    PathTracerShader shd(scene, RGB(0., 0., 0.), true);
+    StandardRenderer renderer(cam, scene, &img, &shd, spp, 1, 16, seed);
+    auto start = std::chrono::steady_clock::now();
+    renderer.Render();
+    *secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<RGB> pixels(IMAGE_SIZE * IMAGE_SIZE);
+    for (int y=0 ; y<IMAGE_SIZE ; y++)
+        for (int x=0 ; x<IMAGE_SIZE ; x++)
+            pixels[y * IMAGE_SIZE + x] = img.get(x, y);
+    return pixels;
+}
+
+static double relativeError (const std::vector<RGB> &img, const std::vector<RGB> &ref) {
+    double err = 0., mean = 0.;
+    for (size_t i=0 ; i<img.size() ; i++) {
+        err += fabs(img[i].R - ref[i].R) + fabs(img[i].G - ref[i].G) + fabs(img[i].B - ref[i].B);
+        mean += ref[i].R + ref[i].G + ref[i].B;
+    }
+    return err / mean;
+}
+
+static double relativeBias (const std::vector<RGB> &img, const std::vector<RGB> &ref) {
+    double sum = 0., refSum = 0.;
+    for (size_t i=0 ; i<img.size() ; i++) {
+        sum += img[i].R + img[i].G + img[i].B;
+        refSum += ref[i].R + ref[i].G + ref[i].B;
+    }
+    return (sum - refSum) / refSum;
+}
+
+int main (int argc, char **argv) {
+    const char *model = argc > 1 ? argv[1] : "models/multiCornellBox.obj";
+    const int maxN = argc > 2 ? atoi(argv[2]) : 16;
+    const int spp = argc > 3 ? atoi(argv[3]) : 16;
+    const int refSpp = argc > 4 ? atoi(argv[4]) : 1024;
+
+    const int nStrategies = 3;
+    const LightSampling strategies[nStrategies] = { LIGHTS_UNIFORM, LIGHTS_POWER, LIGHTS_BVH };
+    double error[16][nStrategies], bias[16][nStrategies], secs[16][nStrategies];
+    int lights[16], nRows = 0;
+
+    // the front of the 2x2 rooms fills the image
+    const float fov = 2.f * atanf(ROOM_W / 50.f);
+    Perspective cam(Point(0, ROOM_H, -50), Point(0, ROOM_H, 0), Vector(0, 1, 0), IMAGE_SIZE, IMAGE_SIZE, fov, fov);
+    for (int N=2 ; N<=maxN && nRows<16 ; N*=2, nRows++) {
+        Scene scene(true);
+        if (!buildRooms(&scene, model, N)) {
+            fprintf(stderr, "cannot load %s\n", model);
+            return 1;
+        }
+        lights[nRows] = scene.numLights;
+        double t;
+        scene.SetLightSampling(LIGHTS_POWER);
+        const std::vector<RGB> ref = render(&scene, &cam, refSpp, 99, &t);
+        for (int s=0 ; s<nStrategies ; s++) {
+            scene.SetLightSampling(strategies[s]);
+            const std::vector<RGB> img = render(&scene, &cam, spp, 1, &secs[nRows][s]);
+            error[nRows][s] = relativeError(img, ref);
+            bias[nRows][s] = relativeBias(img, ref);
+        }
+    }
+
+    printf("\n%s, %dx%d pixels, %d spp against %d spp by power\n", model, IMAGE_SIZE, IMAGE_SIZE, spp, refSpp);
+    printf("relative mean absolute error / bias of the mean in %% (render ms)\n");
+    printf("    N  lights             uniform                   power                     BVH\n");
+    for (int r=0, N=2 ; r<nRows ; r++, N*=2) {
+        printf("%5d %7d", N, lights[r]);
+        for (int s=0 ; s<nStrategies ; s++)
+            printf("   %6.4f %+6.2f%% (%6.1f)", error[r][s], 100. * bias[r][s], 1e3 * secs[r][s]);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+//
+//  RNGBenchmark.cpp
+//  VI-RT
+//
+//  Compares the global rand() against per-thread Samplers when N threads
+//  draw random numbers concurrently, as the render threads do.
+//  usage: RNGBenchmark [max threads] [samples per thread]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "sampler.hpp"
+
+// the shaders draw a few dozen numbers per pixel sample
+const int DRAWS_PER_SAMPLE = 32;
+
+static float drawRand (long n) {
+    float sum = 0.f;
+    for (long i=0 ; i<n ; i++)
+        sum += ((float)rand()) / ((float)RAND_MAX);
+    return sum;
+}
+
+static float drawSampler (long n, int thread) {
+    Sampler sampler(1234);
+    float sum = 0.f;
+    for (long i=0 ; i<n ; i++) {
+        if (i % DRAWS_PER_SAMPLE == 0)
+            sampler.startPixelSample(thread, 0, (int)(i / DRAWS_PER_SAMPLE));
+        sum += sampler.get1D();
+    }
+    return sum;
+}
+
+// returns millions of numbers drawn per second over all threads
+static double run (int nThreads, long n, bool useSampler) {
+    std::vector<std::thread> threads;
+    std::vector<float> sums(nThreads);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t=0 ; t<nThreads ; t++) {
+        threads.push_back(std::thread([&sums, t, n, useSampler] {
+            sums[t] = useSampler ? drawSampler(n, t) : drawRand(n);
+        }));
+    }
+    for (auto &th : threads)
+        th.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    float total = 0.f;
+    for (float s : sums) total += s;
+    if (total < 0.f) printf("%f\n", total);  // keep the sums alive
+
+    return (double)nThreads * n / secs * 1e-6;
+}
+
+int main (int argc, const char *argv[]) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+    long n = argc > 2 ? atol(argv[2]) : 20000000L;
+    if (maxThreads < 1) maxThreads = 1;
+
+    printf("%8s %16s %16s %8s\n", "threads", "rand() M/s", "Sampler M/s", "speedup");
+    // 1, 2, 4, ... threads, always ending with maxThreads
+    for (int t=1 ; t<=maxThreads ; t = (t < maxThreads && t*2 > maxThreads) ? maxThreads : t*2) {
+        double r = run(t, n, false);
+        double s = run(t, n, true);
+        printf("%8d %16.1f %16.1f %7.1fx\n", t, r, s, s / r);
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+//
+//  RefitBenchmark.cpp
+//  VI-RT
+//
+//  Animates one box of the scene (it turns around its vertical axis while
+//  circling its starting position) over a number of frames and times, per
+//  frame, refitting the acceleration structure against building it from
+//  scratch, for the binary BVH and the BVH4. Every 10 frames both are
+//  checked to return the same closest hits for a set of random rays.
+//  usage: RefitBenchmark [model] [frames]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "scene.hpp"
+#include "BVH.hpp"
+#include "BVH4.hpp"
+#include "BenchmarkRays.hpp"
+
+struct Animation {
+    Primitive *prim;
+    Mesh *mesh;
+    std::vector<Point> rest;    // vertices at frame 0
+    Point center;
+    float radius;
+
+    // move the box to its position at time t in [0,1]
+    void set (float t) {
+        const float angle = 2.f * (float)M_PI * t;
+        const float c = cosf(angle), s = sinf(angle);
+        const float dx = radius * sinf(angle), dz = radius * (1.f - cosf(angle));
+        for (size_t v=0 ; v<rest.size() ; v++) {
+            const float x = rest[v].X - center.X, z = rest[v].Z - center.Z;
+            mesh->vertices[v] = Point(center.X + c * x - s * z + dx, rest[v].Y, center.Z + s * x + c * z + dz);
+        }
+        mesh->updateGeometry();
+    }
+};
+
+static long mismatches (AccelStruct *a, AccelStruct *b, const std::vector<Ray> &rays) {
+    std::vector<float> da, db;
+    traceDepths(a, rays, &da);
+    traceDepths(b, rays, &db);
+    return depthMismatches(da, db);
+}
+
+template <typename Accel>
+static void run (const char *name, Scene *scene, Animation &anim, int frames, const std::vector<Ray> &rays,
+                 Accel *refitted, Accel *rebuilt) {
+    anim.set(0.f);
+    refitted->verbose = rebuilt->verbose = false;
+    refitted->build(scene);
+
+    double refitTime = 0., rebuildTime = 0.;
+    int rebuilds = 0;
+    long wrong = 0;
+    for (int f=1 ; f<=frames ; f++) {
+        anim.set((float)f / frames);
+
+        auto start = std::chrono::steady_clock::now();
+        if (!refitted->refit()) rebuilds++;
+        auto mid = std::chrono::steady_clock::now();
+        rebuilt->build(scene);
+        auto end = std::chrono::steady_clock::now();
+        refitTime += std::chrono::duration<double>(mid - start).count();
+        rebuildTime += std::chrono::duration<double>(end - mid).count();
+
+        if (f % 10 == 0)
+            wrong += mismatches(refitted, rebuilt, rays);
+    }
+    printf("%-6s %12.4f %14.4f %9.2f %10d %15ld\n", name, 1e3 * refitTime / frames, 1e3 * rebuildTime / frames,
+           rebuildTime / refitTime, rebuilds, wrong);
+}
+
+int main (int argc, char **argv) {
+    const char *model = argc > 1 ? argv[1] : "models/multiCornellBox.obj";
+    const int frames = argc > 2 ? atoi(argv[2]) : 100;
+
+    Scene scene(false);
+    if (!scene.Load(model)) {
+        fprintf(stderr, "cannot load %s\n", model);
+        return 1;
+    }
+
+    // the first mesh with more faces than a wall
+    Animation anim;
+    anim.mesh = nullptr;
+    for (auto p : scene.getPrims()) {
+        Mesh *m = dynamic_cast<Mesh *>(p->g);
+        if (m && m->numFaces > 2) {
+            anim.prim = p;
+            anim.mesh = m;
+            break;
+        }
+    }
+    if (!anim.mesh) {
+        fprintf(stderr, "no box in %s\n", model);
+        return 1;
+    }
+    anim.rest = anim.mesh->vertices;
+    anim.center = anim.mesh->bb.center();
+    const Vector size = anim.mesh->bb.min.vec2point(anim.mesh->bb.max);
+    anim.radius = 0.5f * std::max(size.X, size.Z);
+
+    const std::vector<Ray> rays = randomRays(&scene, 10000);
+
+    printf("%s, %d frames, box with %d faces\n", model, frames, anim.mesh->numFaces);
+    printf("       refit ms/frame  build ms/frame  speedup  rebuilds  hit mismatches\n");
+    BVH bvhRefit(1, SPLIT_SAH), bvhBuild(1, SPLIT_SAH);
+    run("BVH", &scene, anim, frames, rays, &bvhRefit, &bvhBuild);
+    BVH4 bvh4Refit(SPLIT_SAH), bvh4Build(SPLIT_SAH);
+    run("BVH4", &scene, anim, frames, rays, &bvh4Refit, &bvh4Build);
+    return 0;
+}
@@ -0,0 +1,123 @@
+//
+//  TraversalBenchmark.cpp
+//  VI-RT
+//
+//  Time per ray of the closest hit (trace) and any hit (occluded) queries of
+//  the binary BVH, the 4-wide BVH4 and the uniform grid on the same set of incoherent rays
+//  (random origins inside the scene bounds, random directions), as traced by
+//  the path tracer after the first bounce, and of the camera rays of a
+//  1024x1024 image traced one by one and in packets.
+//  usage: TraversalBenchmark [model] [rays]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include "scene.hpp"
+#include "BVH.hpp"
+#include "BVH4.hpp"
+#include "UniformGrid.hpp"
+#include "BenchmarkRays.hpp"
+#include "perspective.hpp"
+#include "RayPacket.hpp"
+
+struct QueryResult {
+    double traceNs, occludedNs;
+    std::vector<float> depth;   // closest hit distance per ray, -1 on a miss
+    long occludedCount;
+};
+
+static QueryResult run (AccelStruct *accel, const std::vector<Ray> &rays, float tmax) {
+    QueryResult res;
+    res.occludedCount = 0;
+
+    res.traceNs = 1e9 * traceDepths(accel, rays, &res.depth) / rays.size();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0 ; i<rays.size() ; i++)
+        res.occludedCount += accel->occluded(rays[i], tmax);
+    auto end = std::chrono::steady_clock::now();
+    res.occludedNs = std::chrono::duration<double, std::nano>(end - start).count() / rays.size();
+    return res;
+}
+
+// camera rays in 4x2 pixel packets, same layout as StandardRenderer
+static void cameraRays (AccelStruct *accel, Camera *cam, int W, int H, bool packets,
+                        double *ns, long *hits) {
+    RayPacket8 packet;
+    IntersectionPacket8 isects;
+    *hits = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int by=0 ; by<H ; by+=2) {
+        for (int bx=0 ; bx<W ; bx+=4) {
+            packet.n = 0;
+            for (int y=by ; y<by+2 ; y++)
+                for (int x=bx ; x<bx+4 ; x++)
+                    cam->GenerateRay(x, y, &packet.rays[packet.n++]);
+            if (packets)
+                accel->traceRays(packet, isects);
+            else
+                for (int k=0 ; k<packet.n ; k++)
+                    isects.hit[k] = accel->trace(packet.rays[k], &isects.isect[k]);
+            for (int k=0 ; k<packet.n ; k++)
+                *hits += isects.hit[k];
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    *ns = std::chrono::duration<double, std::nano>(end - start).count() / ((double)W * H);
+}
+
+int main (int argc, char **argv) {
+    const char *model = argc > 1 ? argv[1] : "models/multiCornellBox_4x4.obj";
+    const long nRays = argc > 2 ? atol(argv[2]) : 1000000;
+
+    Scene scene(false);
+    if (!scene.Load(model)) {
+        fprintf(stderr, "cannot load %s\n", model);
+        return 1;
+    }
+
+    BB bounds;
+    const std::vector<Ray> rays = randomRays(&scene, nRays, &bounds);
+    const Vector extent = bounds.min.vec2point(bounds.max);
+    // shadow rays towards a point a quarter of the scene away
+    const float tmax = 0.25f * sqrtf(extent.X * extent.X + extent.Y * extent.Y + extent.Z * extent.Z);
+
+    BVH bvh(1, SPLIT_SAH);
+    bvh.build(&scene);
+    BVH4 bvh4(SPLIT_SAH);
+    bvh4.build(&scene);
+    UniformGrid grid;
+    grid.build(&scene);
+    printf("\n");
+
+    QueryResult r2 = run(&bvh, rays, tmax);
+    QueryResult r4 = run(&bvh4, rays, tmax);
+    QueryResult rg = run(&grid, rays, tmax);
+
+    const long mismatches = depthMismatches(r2.depth, r4.depth);
+    const long gridMismatches = depthMismatches(r2.depth, rg.depth);
+
+    printf("%ld rays, %s\n", nRays, model);
+    printf("           trace ns/ray   occluded ns/ray\n");
+    printf("BVH      %14.1f %17.1f\n", r2.traceNs, r2.occludedNs);
+    printf("BVH4     %14.1f %17.1f\n", r4.traceNs, r4.occludedNs);
+    printf("speedup  %14.2f %17.2f\n", r2.traceNs / r4.traceNs, r2.occludedNs / r4.occludedNs);
+    printf("hit mismatches: %ld, occluded: %ld vs %ld\n", mismatches, r2.occludedCount, r4.occludedCount);
+    printf("Grid     %14.1f %17.1f\n", rg.traceNs, rg.occludedNs);
+    printf("hit mismatches vs BVH: %ld, occluded: %ld\n", gridMismatches, rg.occludedCount);
+
+    // camera of main.cpp
+    const int W = 1024, H = 1024;
+    const float fov = 90.f * 3.14f / 180.f;
+    Perspective cam(Point(0, 56, -50), Point(0, 56, 0), Vector(0, 1, 0), W, H, fov, fov);
+    double singleNs, packetNs;
+    long singleHits, packetHits;
+    cameraRays(&bvh4, &cam, W, H, false, &singleNs, &singleHits);
+    cameraRays(&bvh4, &cam, W, H, true, &packetNs, &packetHits);
+    printf("\ncamera rays %dx%d (BVH4): %.1f ns/ray one by one, %.1f ns/ray in packets of %d (%.2fx), hits %ld vs %ld\n",
+           W, H, singleNs, packetNs, PACKET_SIZE, singleNs / packetNs, singleHits, packetHits);
+    return 0;
+}
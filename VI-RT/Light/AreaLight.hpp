@@ -16,12 +16,12 @@ class AreaLight: public Light {
 public:
     RGB intensity, power;
     Triangle *gem;
-    float pdf;
+    float areaPdf;
     AreaLight (RGB _power, Point _v1, Point _v2, Point _v3, Vector _n): power(_power) {
         type = AREA_LIGHT;
         gem = new Triangle (_v1, _v2, _v3, _n);
-        pdf = 1.f/gem->area();  // for uniform sampling over the area
-        intensity = _power * pdf;
+        areaPdf = 1.f/gem->area();  // for uniform sampling over the area
+        intensity = _power * areaPdf;
     }
     ~AreaLight () {delete gem;}
     // return the Light RGB radiance for a given point : p
@@ -37,9 +37,19 @@ public:
         p->X = alpha*gem->v1.X + beta*gem->v2.X + gamma*gem->v3.X;
         p->Y = alpha*gem->v1.Y + beta*gem->v2.Y + gamma*gem->v3.Y;
         p->Z = alpha*gem->v1.Z + beta*gem->v2.Z + gamma*gem->v3.Z;
-        _pdf = pdf;
+        _pdf = areaPdf;
         return intensity;
     }
-        };
+    // probability density (per unit area) of the points returned by Sample_L
+    float pdf (Point p) {return areaPdf;}
+    // the same density per unit solid angle, for point p seen from x:
+    // pdf_A * distance^2 / cos, with cos at the light (0 if x is behind it)
+    float pdf (const Point &x, const Point &p) {
+        Vector d = x.vec2point(p);
+        const float dist2 = d.dot(d);
+        const float cosL = -d.dot(gem->normal) / sqrtf(dist2);
+        return (cosL > 0.f) ? areaPdf * dist2 / cosL : 0.f;
+    }
+};
 
 #endif /* AreaLight_hpp */
@@ -55,7 +55,14 @@ public:
         return (min + max) * 0.5f;
     }
 
-    bool intersect(Ray r)
+    // surface area, used by the SAH
+    float area() const
+    {
+        const float dx = max.X - min.X, dy = max.Y - min.Y, dz = max.Z - min.Z;
+        return 2.f * (dx * dy + dy * dz + dz * dx);
+    }
+
+    bool intersect(const Ray &r) const
     {
         float temp;
         float tmin = (min.X - r.o.X) / r.dir.X;
@@ -162,6 +169,29 @@ public:
         return true;
     }
 
+    // slab test with the ray's precomputed reciprocal direction and sign
+    // (see pbrt book (3rd ed.), sec 3.9.1): no divisions and no swaps.
+    // Returns the entry distance in *tEnter if the box is hit within [0, tmax].
+    bool intersect(const Ray &r, float tmax, float *tEnter) const
+    {
+        const Point &lo = r.sign[0] ? max : min, &hi = r.sign[0] ? min : max;
+        float t0 = (lo.X - r.o.X) * r.invDir.X;
+        float t1 = (hi.X - r.o.X) * r.invDir.X;
+        const float ty0 = ((r.sign[1] ? max : min).Y - r.o.Y) * r.invDir.Y;
+        const float ty1 = ((r.sign[1] ? min : max).Y - r.o.Y) * r.invDir.Y;
+        const float tz0 = ((r.sign[2] ? max : min).Z - r.o.Z) * r.invDir.Z;
+        const float tz1 = ((r.sign[2] ? min : max).Z - r.o.Z) * r.invDir.Z;
+        // written so that NaNs (0 * inf, ray in a slab plane) do not reject the box
+        if (ty0 > t0) t0 = ty0;
+        if (tz0 > t0) t0 = tz0;
+        if (ty1 < t1) t1 = ty1;
+        if (tz1 < t1) t1 = tz1;
+        if (t0 > t1 || t0 > tmax || t1 < 0.f)
+            return false;
+        *tEnter = t0;
+        return true;
+    }
+
     bool
     isInside(Point p1)
     {
@@ -6,3 +6,33 @@
 //
 
 #include "Phong.hpp"
+#include <math.h>
+
+// mirror reflection of wo about n
+static Vector reflect (const Vector &wo, const Vector &n) {
+    return 2.f * n.dot(wo) * n - wo;
+}
+
+RGB Phong::f (const Vector &wi, const Vector &wo, const Vector &n) const {
+    if (n.dot(wi) <= 0.f) return RGB();
+    RGB value = Kd * (float)(1. / M_PI);
+    if (!isMirror()) {
+        const float cosAlpha = reflect(wo, n).dot(wi);
+        if (cosAlpha > 0.f)
+            value += Ks * (float)((Ns + 2.) / (2. * M_PI) * powf(cosAlpha, Ns));
+    }
+    return value;
+}
+
+float Phong::pdf (const Vector &wi, const Vector &wo, const Vector &n) const {
+    const float cosTheta = n.dot(wi);
+    if (cosTheta <= 0.f) return 0.f;
+    const float s_p = specularProbability();
+    float p = (1.f - s_p) * cosTheta / (float)M_PI;
+    if (!isMirror()) {
+        const float cosAlpha = reflect(wo, n).dot(wi);
+        if (cosAlpha > 0.f)
+            p += s_p * (float)((Ns + 1.) / (2. * M_PI) * powf(cosAlpha, Ns));
+    }
+    return p;
+}
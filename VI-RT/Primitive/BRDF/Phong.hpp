@@ -14,7 +14,22 @@
 class Phong: public BRDF {
 public:
     RGB Ka, Kd, Ks, Kt;
+    RGB Ke;     // emitted radiance, faces with Ke > 0 become area lights
     float Ns;
+
+    // ideal mirrors have no glossy lobe: they reflect along a single direction
+    bool isMirror () const { return Ns >= 1000.f; }
+    // probability of sampling the specular lobe rather than the diffuse one
+    float specularProbability () const { return Ks.Y() / (Ks.Y() + Kd.Y()); }
+    // modified Phong BRDF (Lafortune and Willems, 1994), for unit directions
+    // and the shading normal n:
+    // Kd / pi + Ks (Ns+2) / (2 pi) cos^Ns(alpha), alpha the angle between wi
+    // and the mirror reflection of wo (no glossy term for ideal mirrors)
+    RGB f (const Vector &wi, const Vector &wo, const Vector &n) const;
+    // solid angle density of wi when the lobe is chosen with
+    // specularProbability and sampled proportionally to cos (diffuse) or
+    // cos^Ns(alpha) (glossy), as PathTracerShader does
+    float pdf (const Vector &wi, const Vector &wo, const Vector &n) const;
 };
 
 #endif /* Phong_hpp */
@@ -15,10 +15,15 @@
 class Geometry {
 public:
     Geometry () {}
-    ~Geometry () {}
+    virtual ~Geometry () {}
     // return True if r intersects this geometric primitive
     // returns data about intersection on isect
-    virtual bool intersect (Ray r, Intersection *isect) { return false; }
+    virtual bool intersect (const Ray &r, Intersection *isect) { return false; }
+    // any hit closer than tmax (shadow rays)
+    virtual bool occluded (const Ray &r, float tmax) {
+        Intersection isect;
+        return intersect(r, &isect) && isect.depth < tmax;
+    }
     // geometric primitive bounding box
     BB bb;  // this is min={0.,0.,0.} , max={0.,0.,0.} due to the Point constructor
 };
@@ -0,0 +1,39 @@
+//
+//  instance.cpp
+//  VI-RT
+//
+
+#include "instance.hpp"
+#include "MeshBVH.hpp"
+
+Instance::Instance (Mesh *_mesh, MeshBVH *_blas, const Transform &_toWorld):
+    mesh(_mesh), blas(_blas), toWorld(_toWorld), toObject(_toWorld.inverse()) {
+    // world box: the box of the 8 transformed corners of the mesh box
+    const Point &lo = mesh->bb.min, &hi = mesh->bb.max;
+    for (int c=0 ; c<8 ; c++) {
+        Point p = toWorld.point(Point((c & 1) ? hi.X : lo.X, (c & 2) ? hi.Y : lo.Y, (c & 4) ? hi.Z : lo.Z));
+        if (c == 0) bb.min = bb.max = p;
+        else bb.update(p);
+    }
+}
+
+bool Instance::intersect (const Ray &r, Intersection *isect) {
+    if (!bb.intersect(r)) return false;
+
+    Ray ro(toObject.point(r.o), toObject.vector(r.dir));
+    if (!blas->trace(ro, isect)) return false;
+
+    isect->p = r.o + r.dir * isect->depth;
+    Vector n = Transform::normal(toObject, isect->gn);
+    n.normalize();
+    isect->gn = isect->sn = n;
+    isect->wo = -1.f * r.dir;
+    return true;
+}
+
+bool Instance::occluded (const Ray &r, float tmax) {
+    if (!bb.intersect(r)) return false;
+
+    Ray ro(toObject.point(r.o), toObject.vector(r.dir));
+    return blas->occluded(ro, tmax);
+}
@@ -0,0 +1,31 @@
+//
+//  instance.hpp
+//  VI-RT
+//
+
+#ifndef instance_hpp
+#define instance_hpp
+
+#include "geometry.hpp"
+#include "mesh.hpp"
+#include "transform.hpp"
+
+class MeshBVH;
+
+// A mesh placed in the scene by an affine transform. The mesh, and its
+// bottom level BVH, are shared by all its instances: rays are transformed
+// into the mesh's space to be traced, the hit is transformed back.
+// The ray direction is not normalized in object space, so hit distances
+// are the same in both spaces.
+class Instance: public Geometry {
+public:
+    Mesh *mesh;
+    MeshBVH *blas;
+    Transform toWorld, toObject;
+
+    Instance (Mesh *_mesh, MeshBVH *_blas, const Transform &_toWorld);
+    bool intersect (const Ray &r, Intersection *isect);
+    bool occluded (const Ray &r, float tmax);
+};
+
+#endif /* instance_hpp */
@@ -6,6 +6,7 @@
 //
 
 #include "mesh.hpp"
+#include "MeshBVH.hpp"
 
 // see pbrt book (3rd ed.), sec 3.6.2, pag 157
 //
@@ -15,9 +16,8 @@
 
 #include <stdio.h>
 
-bool Mesh::TriangleIntersect (Ray r, Face f, Intersection *isect) {
-    if (!bb.intersect(r)) return false;
-
+bool Mesh::TriangleIntersect (const Ray &r, int face, TriangleHit *hit) {
+    const Face &f = faces[face];
     Point p1 = this->vertices[f.vert_ndx[0]];
     Point p2 = this->vertices[f.vert_ndx[1]];
     Point p3 = this->vertices[f.vert_ndx[2]];
@@ -48,54 +48,89 @@ bool Mesh::TriangleIntersect (Ray r, Face f, Intersection *isect) {
     float t = inv_det * edge2.dot(s_cross_e1);
 
 
-    if (t > EPSILON) // intersection
+    if (t > EPSILON && t < hit->t) // closer intersection
     {
-
-        // Fill Intersection data
-        Vector normal = f.geoNormal;
-        Vector wo = -1.f * r.dir;
-        // make sure the normal points to the same side of the surface as wo
-        normal.Faceforward(wo);
-        isect->gn = normal;
-        isect->sn = normal;
-        isect->p = r.o  + r.dir * t;
-        isect->wo = wo;
-        isect->FaceID = f.FaceID;
-        isect->isLight = false;
-        isect->depth = t;
+        hit->t = t;
+        hit->u = u;
+        hit->v = v;
+        hit->triangle = face;
         return true;
     }
 
     return false;
 }
 
-bool Mesh::intersect (Ray r, Intersection *isect) {
-    bool intersect = true, intersect_this_face;
-    Intersection min_isect, curr_isect;
-    float min_depth=MAXFLOAT;
+bool Mesh::intersect (const Ray &r, Intersection *isect) {
     // intersect the ray with the mesh BB
     if (!bb.intersect(r)) return false;
-    
-    // If it intersects then loop through the faces
-    intersect = false;
-    for (auto face_it=faces.begin() ; face_it != faces.end() ; face_it++) {
-        intersect_this_face = TriangleIntersect(r, *face_it.base(), &curr_isect);
-        if (!intersect_this_face) continue;
-        
-        intersect = true;
-        if (curr_isect.depth < min_depth) {  // this is closer
-            min_depth = curr_isect.depth;
-            min_isect = curr_isect;
-        }
+
+    TriangleHit hit;
+    if (bvh) {
+        if (!bvh->trace(r, &hit)) return false;
     }
+    else {
+        // If it intersects then loop through the faces, keeping the closest hit
+        for (int face=0 ; face < (int)faces.size() ; face++)
+            TriangleIntersect(r, face, &hit);
+        if (hit.triangle < 0) return false;
+    }
+    fillHit(hit, r, isect);
+    return true;
+}
 
-    isect->p = min_isect.p;
-    isect->wo = min_isect.wo;
-    isect->gn = min_isect.gn;
-    isect->sn = min_isect.sn;
-    isect->FaceID = min_isect.FaceID;
-    isect->depth = min_isect.depth;
+void Mesh::fillHit (const TriangleHit &hit, const Ray &r, Intersection *isect) {
+    const Face &f = faces[hit.triangle];
+    isect->p = r.o  + r.dir * hit.t;
+    isect->wo = -1.f * r.dir;
+    isect->gn = f.geoNormal;
+    isect->sn = f.geoNormal;
+    isect->FaceID = f.FaceID;
+    isect->depth = hit.t;
+    isect->u = hit.u;
+    isect->v = hit.v;
     isect->isLight = false;
+}
+
+bool Mesh::occluded (const Ray &r, float tmax) {
+    if (!bb.intersect(r)) return false;
 
-    return intersect;
+    if (bvh)
+        return bvh->occluded(r, tmax);
+    TriangleHit hit(tmax);
+    for (int face=0 ; face < (int)faces.size() ; face++)
+        if (TriangleIntersect(r, face, &hit))
+            return true;
+    return false;
+}
+
+void Mesh::buildBVH () {
+    delete bvh;
+    bvh = new MeshBVH(this);
+}
+
+Mesh::~Mesh () {
+    delete bvh;
+}
+
+void Mesh::updateGeometry () {
+    if (vertices.empty()) return;
+
+    bb.min = bb.max = vertices[0];
+    for (auto &v : vertices)
+        bb.update(v);
+
+    for (auto &f : faces) {
+        Point p1 = vertices[f.vert_ndx[0]];
+        Point p2 = vertices[f.vert_ndx[1]];
+        Point p3 = vertices[f.vert_ndx[2]];
+        f.bb.min = f.bb.max = p1;
+        f.bb.update(p2);
+        f.bb.update(p3);
+        // same as Scene::Load
+        Vector normal = p1.vec2point(p2).cross(p1.vec2point(p3));
+        normal.normalize();
+        f.geoNormal.set(normal);
+    }
+    if (bvh)
+        buildBVH();
 }
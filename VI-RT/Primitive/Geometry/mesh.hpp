@@ -24,9 +24,15 @@ typedef struct Face {
     int FaceID;
 } Face;
 
+class MeshBVH;
+
 class Mesh: public Geometry {
 private:
-    bool TriangleIntersect (Ray r, Face f, Intersection *isect);
+    // test face (index in faces): records the hit in hit if closer than hit->t
+    bool TriangleIntersect (const Ray &r, int face, TriangleHit *hit);
+    // fill isect with the hit of face hit.triangle
+    void fillHit (const TriangleHit &hit, const Ray &r, Intersection *isect);
+    MeshBVH *bvh;       // optional, see buildBVH
 public:
     int numFaces;
     std::vector<Face> faces;
@@ -34,9 +40,23 @@ public:
     std::vector<Point> vertices;
     int numNormals;
     std::vector<Vector> normals;
-    bool intersect (Ray r, Intersection *isect);
+    bool intersect (const Ray &r, Intersection *isect);
+    bool occluded (const Ray &r, float tmax);
+    // build a BVH over the faces, so that intersect and occluded do not test
+    // all of them; for scenes without an acceleration structure, or traced
+    // by a top level BVH
+    void buildBVH ();
+    bool hasBVH () const { return bvh != nullptr; }
+    // recompute the face and mesh bounding boxes and the geometric normals
+    // after the vertices have been moved (and rebuild the BVH, if any)
+    void updateGeometry ();
     
-    Mesh(): numFaces(0), numVertices(0), numNormals(0) {}
+    Mesh(): bvh(nullptr), numFaces(0), numVertices(0), numNormals(0) {}
+    // copies do not share the BVH (they are usually moved)
+    Mesh(const Mesh &m): Geometry(m), bvh(nullptr), numFaces(m.numFaces), faces(m.faces),
+        numVertices(m.numVertices), vertices(m.vertices), numNormals(m.numNormals), normals(m.normals) {}
+    Mesh &operator= (const Mesh &) = delete;
+    ~Mesh();
 };
 
 #endif /* mesh_hpp */
@@ -11,7 +11,7 @@
 
 // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
 // Moller Trumbore intersection algorithm
-bool Triangle::intersect(Ray r, Intersection *isect)
+bool Triangle::intersect(const Ray &r, Intersection *isect)
 {
 
     if (!bb.intersect(r))
@@ -52,6 +52,8 @@ bool Triangle::intersect(Ray r, Intersection *isect)
         isect->p = r.o + r.dir * t;
         isect->wo = wo;
         isect->FaceID = -1;
+        isect->u = u;
+        isect->v = v;
         isect->isLight = false;
         isect->depth = t;
         return true;
@@ -18,9 +18,8 @@ public:
     Point v1, v2, v3;
     Vector normal; // geometric normal
     Vector edge1, edge2;
-    BB bb; // face bounding box
-           // this is min={0.,0.,0.} , max={0.,0.,0.} due to the Point constructor
-    bool intersect(Ray r, Intersection *isect);
+    // the face bounding box is Geometry::bb
+    bool intersect(const Ray &r, Intersection *isect);
     bool isInside(Point p);
 
     Point middlePoint()
@@ -38,8 +37,6 @@ public:
         bb.update(v3);
     }
 
-    Triangle(const Triangle &other) : v1(other.v1), v2(other.v2), v3(other.v3), normal(other.normal), edge1(other.edge1), edge2(other.edge2), bb(other.bb) {}
-
     // Heron's formula
     // https://www.mathopenref.com/heronsformula.html
     float area()
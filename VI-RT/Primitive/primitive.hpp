@@ -14,6 +14,8 @@
 typedef struct Primitive {
     Geometry *g;
     int material_ndx;
+    int light_ndx;  // index in Scene::lights for light source geometry, -1 otherwise
+    Primitive () : g(nullptr), material_ndx(-1), light_ndx(-1) {}
 } Primitive;
 
 #endif /* primitive_hpp */
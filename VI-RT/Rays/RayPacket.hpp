@@ -0,0 +1,29 @@
+//
+//  RayPacket.hpp
+//  VI-RT
+//
+
+#ifndef RayPacket_hpp
+#define RayPacket_hpp
+
+#include "ray.hpp"
+#include "intersection.hpp"
+
+const int PACKET_SIZE = 8;
+
+// up to PACKET_SIZE coherent rays (e.g. neighbouring camera rays) traced
+// together: the acceleration structure walks them down a shared node stack
+class RayPacket8 {
+public:
+    Ray rays[PACKET_SIZE];
+    int n;      // rays in use: rays[0 .. n-1]
+    RayPacket8 (): n(0) {}
+};
+
+class IntersectionPacket8 {
+public:
+    Intersection isect[PACKET_SIZE];
+    bool hit[PACKET_SIZE];
+};
+
+#endif /* RayPacket_hpp */
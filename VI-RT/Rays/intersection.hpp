@@ -10,6 +10,7 @@
 
 #include "vector.hpp"
 #include "BRDF.hpp"
+#include <float.h>
 
 typedef struct Intersection {
 public:
@@ -21,8 +22,10 @@ public:
     BRDF *f;     // pointer to the material
     int pix_x, pix_y;
     int FaceID;  // ID of the intersected face 
+    float u, v;  // barycentric coordinates of p in the triangle hit (weights of its 2nd and 3rd vertices)
     bool isLight;  // for intersections with light sources
     RGB Le;         // for intersections with light sources
+    int light_ndx;  // for intersections with light sources: index in Scene::lights
     
     
     Intersection() {}
@@ -31,4 +34,13 @@ public:
     : p(p), gn(n), sn(n), wo(wo), depth(depth), f(NULL) { }
 } Intersection;
 
+// What the triangle tests of a traversal keep of the closest hit so far;
+// the Intersection is only filled for the final one, after the traversal.
+struct TriangleHit {
+    float t;        // distance along the ray
+    float u, v;     // barycentric coordinates, see Intersection
+    int triangle;   // index of the triangle (or face) hit, -1 if none
+    TriangleHit (float tmax=FLT_MAX): t(tmax), u(0.f), v(0.f), triangle(-1) {}
+};
+
 #endif /* Intersection_hpp */
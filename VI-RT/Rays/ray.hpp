@@ -18,11 +18,20 @@ public:
     Vector dir; // ray direction
     int FaceID;  // ID of the face where the origin lays in
     Vector invDir;  // ray direction reciprocal for intersections
+    int sign[3];    // 1 if the direction is negative along X, Y, Z
     int pix_x, pix_y;
     Ray () {}
-    Ray (Point o, Vector d): o(o),dir(d) {}
+    Ray (const Point &o, const Vector &d): o(o) { setDirection(d); }
     ~Ray() {}
-    void adjustOrigin (Vector normal) {
+    // set dir and the derived invDir / sign used by the box slab tests
+    void setDirection (const Vector &d) {
+        dir = d;
+        invDir = Vector(1.f / d.X, 1.f / d.Y, 1.f / d.Z);
+        sign[0] = invDir.X < 0.f;
+        sign[1] = invDir.Y < 0.f;
+        sign[2] = invDir.Z < 0.f;
+    }
+    void adjustOrigin (const Vector &normal) {
         Vector offset = EPSILON * normal;
         if (dir.dot(normal) < 0)
             offset = -1.f * offset;
@@ -8,46 +8,279 @@
 #include "StandardRenderer.hpp"
 #include <AmbientShader.hpp>
 #include <ImagePPM.hpp>
+#include "ThreadPool.hpp"
+#include "sampler.hpp"
+#include "RayPacket.hpp"
+#include <chrono>
+#include <math.h>
 
 const bool jitter = true;
 
-void StandardRenderer::Render()
+// adaptive sampling: no pixel takes more than this many times the average
+// budget, and the relative error of darker pixels is measured against this
+// luminance (so black pixels with a little noise can converge)
+const int ADAPTIVE_MAX_SPP_FACTOR = 8;
+const float ADAPTIVE_MIN_MEAN = 1e-2f;
+
+// camera rays are traced in packets of PACKET_W x PACKET_H pixels
+const int PACKET_W = 4, PACKET_H = PACKET_SIZE / PACKET_W;
+
+// render pixels [x0,x1[ x [y0,y1[
+void StandardRenderer::renderTile(int x0, int y0, int x1, int y1)
 {
-    int W = 0, H = 0; // resolution
-    int x, y, ss;
+    int ss;
+    // one sampler per pixel of the packet: each keeps its pixel sample's
+    // random stream between ray generation and shading
+    Sampler samplers[PACKET_SIZE];
+    RayPacket8 packet;
+    IntersectionPacket8 isects;
 
-    // get resolution from the camera
-    cam->getResolution(&W, &H);
+    for (int by=y0 ; by< y1 ; by+=PACKET_H) {  // loop over rows of packets
+        for (int bx=x0 ; bx< x1 ; bx+=PACKET_W) { // loop over packets in the row
+            int px[PACKET_SIZE], py[PACKET_SIZE];
+            RGB color[PACKET_SIZE];
+            int n = 0;
 
-    for (y=0 ; y< H ; y++) {  // loop over rows
-        for (x=0 ; x< W ; x++) { // loop over columns
-            Ray primary;
-            Intersection isect;
-            bool intersected;
-            RGB color = RGB(0,0,0);
+            for (int y=by ; y < std::min(by + PACKET_H, y1) ; y++) {
+                for (int x=bx ; x < std::min(bx + PACKET_W, x1) ; x++) {
+                    px[n] = x;
+                    py[n] = y;
+                    samplers[n] = Sampler(seed);
+                    color[n] = RGB(0,0,0);
+                    n++;
+                }
+            }
+            packet.n = n;
 
             for (ss = 0 ; ss < spp ; ss++)
             {
+                for (int k=0 ; k < n ; k++) {
+                    // one random stream per pixel sample: the result is the same
+                    // whichever thread renders this pixel
+                    samplers[k].startPixelSample(px[k], py[k], ss);
 
-                // Generate Ray (camera)
-                if (jitter) {
-                    float jitterV[2];
-                    jitterV[0] = ((float)rand()) / ((float)RAND_MAX);
-                    jitterV[1] = ((float)rand()) / ((float)RAND_MAX);
-                    cam->GenerateRay(x, y, &primary, jitterV);
-                } else {
-                    cam->GenerateRay(x, y, &primary);
+                    // Generate Ray (camera)
+                    if (jitter) {
+                        float jitterV[2];
+                        samplers[k].get2D(jitterV);
+                        cam->GenerateRay(px[k], py[k], &packet.rays[k], jitterV);
+                    } else {
+                        cam->GenerateRay(px[k], py[k], &packet.rays[k]);
+                    }
                 }
-                // trace ray (scene)
-                intersected = scene->trace(primary, &isect);
-                
-                // shade this intersection (shader) - remember: depth=0
-                color += shd->shade(intersected, isect, 0);
+                // trace the camera rays together (scene)
+                scene->traceRays(packet, isects);
+
+                // shade each intersection (shader) - remember: depth=0
+                for (int k=0 ; k < n ; k++)
+                    color[k] += shd->shade(isects.hit[k], isects.isect[k], 0, samplers[k]);
             }
-            color = color / spp;
-            // write the result into the image frame buffer (image)
-            img->set(x,y,color);
-            
-        } // loop over columns
-    }   // loop over rows
+            // write the results into the image frame buffer (image)
+            for (int k=0 ; k < n ; k++)
+                img->set(px[k], py[k], color[k] / spp);
+
+        } // loop over packets in the row
+    }   // loop over rows of packets
+}
+
+void StandardRenderer::Render()
+{
+    // get resolution from the camera
+    cam->getResolution(&W, &H);
+
+    if (relError > 0.f) {
+        renderAdaptive();
+        return;
+    }
+
+    if (nThreads == 1 || tileSize <= 0) {
+        // serial path
+        renderTile(0, 0, W, H);
+        return;
+    }
+
+    ThreadPool pool(nThreads);
+    int nTiles = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int ty=0 ; ty < H ; ty += tileSize) {
+        for (int tx=0 ; tx < W ; tx += tileSize) {
+            const int x1 = std::min(tx + tileSize, W), y1 = std::min(ty + tileSize, H);
+            pool.submit([this, tx, ty, x1, y1] { renderTile(tx, ty, x1, y1); });
+            nTiles++;
+        }
+    }
+    pool.wait();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    fprintf(stdout, "Rendered %d tiles (%dx%d) on %d threads in %.3lf secs\n",
+            nTiles, tileSize, tileSize, pool.size(), elapsed);
+    pool.printStats();
+}
+
+void StandardRenderer::setAdaptive(float _relError, int _minSpp)
+{
+    relError = _relError;
+    minSpp = std::max(2, std::min(_minSpp, spp));    // the variance needs 2 samples
+    maxSpp = ADAPTIVE_MAX_SPP_FACTOR * spp;
+}
+
+// relative half width of the pixel's 95% confidence interval
+float StandardRenderer::pixelError(const PixelStats &p) const
+{
+    if (p.n < 2) return INFINITY;
+    const float variance = p.m2 / (p.n - 1);
+    return 1.96f * sqrtf(variance / p.n) / std::max(p.mean, ADAPTIVE_MIN_MEAN);
+}
+
+// samples passSpp[pixel] more of the pixels [x0,x1[ x [y0,y1[, in packets
+// of the pixels that still take samples
+void StandardRenderer::renderTileAdaptive(int x0, int y0, int x1, int y1)
+{
+    Sampler samplers[PACKET_SIZE];
+    RayPacket8 packet;
+    IntersectionPacket8 isects;
+
+    for (int by=y0 ; by< y1 ; by+=PACKET_H) {
+        for (int bx=x0 ; bx< x1 ; bx+=PACKET_W) {
+            int pixel[PACKET_SIZE], px[PACKET_SIZE], py[PACKET_SIZE];
+            int nPixels = 0, passMax = 0;
+            for (int y=by ; y < std::min(by + PACKET_H, y1) ; y++) {
+                for (int x=bx ; x < std::min(bx + PACKET_W, x1) ; x++) {
+                    const int p = y * W + x;
+                    if (passSpp[p] == 0) continue;
+                    pixel[nPixels] = p;
+                    px[nPixels] = x;
+                    py[nPixels] = y;
+                    passMax = std::max(passMax, passSpp[p]);
+                    nPixels++;
+                }
+            }
+
+            for (int s = 0 ; s < passMax ; s++) {
+                // the packet holds the pixels with at least s+1 samples this pass
+                int slot[PACKET_SIZE];
+                int n = 0;
+                for (int k=0 ; k < nPixels ; k++) {
+                    const PixelStats &st = stats[pixel[k]];
+                    if (s >= passSpp[pixel[k]]) continue;
+                    // sample indices continue from the previous passes
+                    samplers[n] = Sampler(seed);
+                    samplers[n].startPixelSample(px[k], py[k], st.n);
+                    if (jitter) {
+                        float jitterV[2];
+                        samplers[n].get2D(jitterV);
+                        cam->GenerateRay(px[k], py[k], &packet.rays[n], jitterV);
+                    } else {
+                        cam->GenerateRay(px[k], py[k], &packet.rays[n]);
+                    }
+                    slot[n++] = pixel[k];
+                }
+                packet.n = n;
+                scene->traceRays(packet, isects);
+
+                for (int k=0 ; k < n ; k++) {
+                    RGB color = shd->shade(isects.hit[k], isects.isect[k], 0, samplers[k]);
+                    PixelStats &st = stats[slot[k]];
+                    const float y = color.Y();
+                    st.n++;
+                    st.sum += color;
+                    const float delta = y - st.mean;
+                    st.mean += delta / st.n;
+                    st.m2 += delta * (y - st.mean);
+                }
+            }
+        }
+    }
+}
+
+void StandardRenderer::renderAdaptive()
+{
+    const int nPixels = W * H;
+    stats.assign(nPixels, PixelStats());
+    passSpp.assign(nPixels, minSpp);
+
+    ThreadPool *pool = nullptr;
+    if (nThreads != 1 && tileSize > 0)
+        pool = new ThreadPool(nThreads);
+
+    const long budget = (long)spp * nPixels;
+    long used = 0;
+    int passes = 0;
+    std::vector<float> need(nPixels);
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        if (pool) {
+            for (int ty=0 ; ty < H ; ty += tileSize) {
+                for (int tx=0 ; tx < W ; tx += tileSize) {
+                    const int x1 = std::min(tx + tileSize, W), y1 = std::min(ty + tileSize, H);
+                    pool->submit([this, tx, ty, x1, y1] { renderTileAdaptive(tx, ty, x1, y1); });
+                }
+            }
+            pool->wait();
+        }
+        else
+            renderTileAdaptive(0, 0, W, H);
+        for (int p=0 ; p < nPixels ; p++)
+            used += passSpp[p];
+        passes++;
+
+        // the error falls with the square root of the samples: a pixel still
+        // needs about n (error / relError)^2 - n of them to converge
+        int active = 0;
+        double needed = 0.;
+        for (int p=0 ; p < nPixels ; p++) {
+            PixelStats &st = stats[p];
+            const float e = pixelError(st);
+            st.done = st.done || e <= relError || st.n >= maxSpp;
+            if (st.done) continue;
+            const float ratio = std::min(e / relError, (float)maxSpp);
+            need[p] = std::max(1.f, std::min(st.n * ratio * ratio - st.n, (float)(maxSpp - st.n)));
+            needed += need[p];
+            active++;
+        }
+        // the next pass takes at most minSpp samples per active pixel on average
+        const long pass = std::min(budget - used, (long)active * minSpp);
+        if (active == 0 || pass < active)
+            break;
+
+        for (int p=0 ; p < nPixels ; p++) {
+            const PixelStats &st = stats[p];
+            passSpp[p] = 0;
+            if (st.done) continue;
+            const int share = (int)(pass * need[p] / needed);
+            passSpp[p] = std::max(1, std::min(share, maxSpp - st.n));
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete pool;
+
+    int converged = 0, fewest = stats[0].n, most = stats[0].n;
+    for (int p=0 ; p < nPixels ; p++) {
+        const PixelStats &st = stats[p];
+        img->set(p % W, p / W, st.sum / st.n);
+        converged += pixelError(st) <= relError;
+        fewest = std::min(fewest, st.n);
+        most = std::max(most, st.n);
+    }
+    fprintf(stdout, "Adaptive: %d passes, %.1f spp on average (budget %d), %d..%d per pixel, "
+            "%.1f%% converged to %.1f%% in %.3lf secs\n", passes, (double)used / nPixels, spp, fewest, most,
+            100. * converged / nPixels, 100. * relError, elapsed);
+}
+
+bool StandardRenderer::SaveSampleMap(const std::string &filename)
+{
+    if (stats.empty()) return false;
+
+    int most = 1;
+    for (const auto &st : stats)
+        most = std::max(most, st.n);
+    ImagePPM map(W, H);
+    for (int p=0 ; p < W * H ; p++) {
+        // blue -> green -> red
+        const float t = (float)stats[p].n / most;
+        map.set(p % W, p / W, RGB(std::max(0.f, 2.f * t - 1.f), 1.f - fabsf(2.f * t - 1.f),
+                                  std::max(0.f, 1.f - 2.f * t)));
+    }
+    return map.Save(filename);
 }
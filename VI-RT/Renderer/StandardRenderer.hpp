@@ -9,15 +9,55 @@
 #define StandardRenderer_hpp
 
 #include "renderer.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 class StandardRenderer: public Renderer {
 private:
     int spp;
+    int nThreads;   // 1 : serial path, 0 : one thread per core
+    int tileSize;   // tiles are tileSize x tileSize pixels
+    uint64_t seed;  // images are reproducible for a fixed seed
+    void renderTile (int x0, int y0, int x1, int y1);
+
+    // adaptive sampling (see setAdaptive): running mean and variance of
+    // each pixel's luminance, updated sample by sample (Welford)
+    struct PixelStats {
+        int n;          // samples taken
+        RGB sum;
+        float mean, m2; // luminance mean and sum of squared deviations
+        bool done;      // converged, or took maxSpp samples
+        PixelStats (): n(0), mean(0.f), m2(0.f), done(false) {}
+    };
+    float relError;     // 0 : fixed spp
+    int minSpp, maxSpp;
+    int W, H;
+    std::vector<PixelStats> stats;
+    std::vector<int> passSpp;   // samples of each pixel in the current pass
+    void renderAdaptive ();
+    void renderTileAdaptive (int x0, int y0, int x1, int y1);
+    float pixelError (const PixelStats &p) const;
 public:
-    StandardRenderer (Camera *cam, Scene * scene, Image * img, Shader *shd, int _spp): Renderer(cam, scene, img, shd) {
+    StandardRenderer (Camera *cam, Scene * scene, Image * img, Shader *shd, int _spp,
+                      int _nThreads=0, int _tileSize=16, uint64_t _seed=0): Renderer(cam, scene, img, shd) {
         spp = _spp;
+        nThreads = _nThreads;
+        tileSize = _tileSize;
+        seed = _seed;
+        relError = 0.f;
+        minSpp = maxSpp = _spp;
+        W = H = 0;
     }
+    // spp becomes the average budget per pixel: every pixel takes _minSpp
+    // samples, then each pass gives more to the pixels whose 95% confidence
+    // interval is still wider than _relError times their mean, the noisiest
+    // first, until the budget is spent
+    void setAdaptive (float _relError, int _minSpp=8);
     void Render ();
+    // samples taken by each pixel in the last adaptive render, from blue
+    // (fewest) to red (most)
+    bool SaveSampleMap (const std::string &filename);
 };
 
 #endif /* StandardRenderer_hpp */
@@ -0,0 +1,133 @@
+//
+//  ThreadPool.cpp
+//  VI-RT
+//
+
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+// identifies the pool (and the deque within it) owned by the calling thread
+static thread_local ThreadPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool (int nThreads): queued(0), pending(0), nextQueue(0), stop(false) {
+    if (nThreads <= 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i=0 ; i<nThreads ; i++)
+        queues.push_back(std::unique_ptr<Queue>(new Queue));
+    for (int i=0 ; i<nThreads ; i++)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool () {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMtx);
+        stop = true;
+    }
+    wakeCV.notify_all();
+    for (auto &w : workers)
+        w.join();
+}
+
+void ThreadPool::submit (std::function<void()> task) {
+    int q;
+    if (currentPool == this)
+        q = currentWorker;
+    else
+        q = (int)(nextQueue++ % queues.size());
+
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(queues[q]->mtx);
+        queues[q]->tasks.push_back(std::move(task));
+    }
+    {
+        // taking the lock orders this increment with a worker about to sleep
+        std::lock_guard<std::mutex> lock(sleepMtx);
+        queued++;
+    }
+    wakeCV.notify_one();
+}
+
+void ThreadPool::wait () {
+    std::unique_lock<std::mutex> lock(sleepMtx);
+    doneCV.wait(lock, [this] { return pending == 0; });
+}
+
+bool ThreadPool::popTask (int id, std::function<void()> &task, bool &stolen) {
+    const int n = (int)queues.size();
+
+    // own deque first, newest task
+    {
+        Queue &q = *queues[id];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            queued--;
+            stolen = false;
+            return true;
+        }
+    }
+    // steal the oldest task of some other worker
+    for (int i=1 ; i<n ; i++) {
+        Queue &q = *queues[(id + i) % n];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            queued--;
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop (int id) {
+    currentPool = this;
+    currentWorker = id;
+    Queue &me = *queues[id];
+
+    while (true) {
+        std::function<void()> task;
+        bool stolen;
+
+        if (!popTask(id, task, stolen)) {
+            std::unique_lock<std::mutex> lock(sleepMtx);
+            wakeCV.wait(lock, [this] { return stop || queued > 0; });
+            if (stop && queued == 0) return;
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        task();
+        auto end = std::chrono::steady_clock::now();
+        me.busy += std::chrono::duration<double>(end - start).count();
+        me.executed++;
+        if (stolen) me.stolen++;
+
+        if (--pending == 0) {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            doneCV.notify_all();
+        }
+    }
+}
+
+void ThreadPool::resetStats () {
+    for (auto &q : queues) {
+        q->busy = 0.;
+        q->executed = q->stolen = 0;
+    }
+}
+
+void ThreadPool::printStats () {
+    for (int i=0 ; i<size() ; i++) {
+        fprintf(stdout, "Thread %2d: busy %.3lf secs, %d tasks (%d stolen)\n",
+                i, queues[i]->busy, queues[i]->executed, queues[i]->stolen);
+    }
+}
@@ -0,0 +1,62 @@
+//
+//  ThreadPool.hpp
+//  VI-RT
+//
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pool of worker threads with one task deque per worker.
+// A worker pops its own tasks from the back (LIFO, good locality for tasks
+// spawned by the task it just ran) and, when it runs dry, steals from the
+// front of the other workers' deques, so expensive tasks at the tail of a
+// job do not leave the remaining threads idle.
+class ThreadPool {
+public:
+    ThreadPool (int nThreads=0);   // 0 : one thread per hardware core
+    ~ThreadPool ();
+    // tasks submitted from a worker go to that worker's deque,
+    // tasks submitted from outside are distributed round robin
+    void submit (std::function<void()> task);
+    // block until every submitted task (including nested ones) has finished
+    void wait ();
+    int size () const { return (int)workers.size(); }
+
+    // per worker statistics, accumulated since construction or resetStats()
+    double busyTime (int worker) const { return queues[worker]->busy; }
+    int tasksRun (int worker) const { return queues[worker]->executed; }
+    int tasksStolen (int worker) const { return queues[worker]->stolen; }
+    void resetStats ();
+    void printStats ();
+
+private:
+    struct Queue {
+        std::deque<std::function<void()> > tasks;
+        std::mutex mtx;
+        double busy;
+        int executed, stolen;
+        Queue (): busy(0.), executed(0), stolen(0) {}
+    };
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> workers;
+    std::atomic<int> queued;    // tasks waiting in the deques
+    std::atomic<int> pending;   // tasks submitted but not finished
+    std::atomic<unsigned> nextQueue;
+    bool stop;
+    std::mutex sleepMtx;
+    std::condition_variable wakeCV, doneCV;
+
+    void workerLoop (int id);
+    bool popTask (int id, std::function<void()> &task, bool &stolen);
+};
+
+#endif /* ThreadPool_hpp */
@@ -0,0 +1,323 @@
+//
+//  WavefrontRenderer.cpp
+//  VI-RT
+//
+
+#include "WavefrontRenderer.hpp"
+#include "StandardRenderer.hpp"
+#include "ThreadPool.hpp"
+#include "AreaLight.hpp"
+#include <math.h>
+#include <chrono>
+
+void WavefrontRenderer::RayQueue::clear () {
+    ox.clear(); oy.clear(); oz.clear();
+    dx.clear(); dy.clear(); dz.clear();
+    path.clear(); tmax.clear(); L.clear();
+}
+
+void WavefrontRenderer::RayQueue::push (const Ray &r, int p) {
+    ox.push_back(r.o.X); oy.push_back(r.o.Y); oz.push_back(r.o.Z);
+    dx.push_back(r.dir.X); dy.push_back(r.dir.Y); dz.push_back(r.dir.Z);
+    path.push_back(p);
+}
+
+Ray WavefrontRenderer::RayQueue::ray (int i) const {
+    return Ray(Point(ox[i], oy[i], oz[i]), Vector(dx[i], dy[i], dz[i]));
+}
+
+// counting sort on a 6 bit key: direction octant, then origin octant
+// relative to the mean origin of the queue
+void WavefrontRenderer::sortQueue (RayQueue &q, RayQueue &tmp) {
+    const int n = q.size();
+    if (n < 2) return;
+
+    float cx = 0.f, cy = 0.f, cz = 0.f;
+    for (int i=0 ; i<n ; i++) {
+        cx += q.ox[i]; cy += q.oy[i]; cz += q.oz[i];
+    }
+    cx /= n; cy /= n; cz /= n;
+
+    std::vector<uint8_t> key(n);
+    int count[64] = {0};
+    for (int i=0 ; i<n ; i++) {
+        key[i] = (uint8_t)(((q.dx[i] < 0.f) << 5) | ((q.dy[i] < 0.f) << 4) | ((q.dz[i] < 0.f) << 3) |
+                           ((q.ox[i] < cx) << 2) | ((q.oy[i] < cy) << 1) | (q.oz[i] < cz));
+        count[key[i]]++;
+    }
+    int start[64];
+    for (int k=0, sum=0 ; k<64 ; k++) {
+        start[k] = sum;
+        sum += count[k];
+    }
+
+    tmp.clear();
+    tmp.ox.resize(n); tmp.oy.resize(n); tmp.oz.resize(n);
+    tmp.dx.resize(n); tmp.dy.resize(n); tmp.dz.resize(n);
+    tmp.path.resize(n);
+    for (int i=0 ; i<n ; i++) {
+        const int j = start[key[i]]++;
+        tmp.ox[j] = q.ox[i]; tmp.oy[j] = q.oy[i]; tmp.oz[j] = q.oz[i];
+        tmp.dx[j] = q.dx[i]; tmp.dy[j] = q.dy[i]; tmp.dz[j] = q.dz[i];
+        tmp.path[j] = q.path[i];
+    }
+    std::swap(q, tmp);
+}
+
+// shading stage for one path vertex (see PathTracerShader::shade): adds the
+// emission seen by the path, queues a shadow ray towards one sampled light and
+// the continuation ray (Russian roulette after the first MAX_DEPTH bounces)
+void WavefrontRenderer::shadeHit (int i, const RayQueue &rays, const Intersection &isect, PathStates &paths,
+                                  RayQueue &next, RayQueue &shadows, std::vector<RGB> &radiance) {
+    const int p = rays.path[i];
+    RGB thr = paths.throughput[p];
+    Sampler &sampler = paths.sampler[p];
+    const int depth = paths.depth[p];
+
+    if (isect.isLight) {
+        // lights hit after a diffuse bounce are accounted for by direct lighting
+        if (!paths.diffuseBounce[p])
+            radiance[paths.pixel[p]] += thr * isect.Le;
+        return;
+    }
+
+    Phong *f = (Phong *)isect.f;
+
+    // direct lighting: one light chosen by the scene's light sampling strategy
+    float light_pdf;
+    int l_ndx = -1;
+    if (!f->Kd.isZero() && scene->numLights > 0)
+        l_ndx = scene->sampleLight(isect.p, isect.sn, sampler.get1D(), &light_pdf);
+    if (l_ndx >= 0) {
+        Light *l = scene->lights[l_ndx];
+        RGB Kd = f->Kd;
+
+        if (l->type == AMBIENT_LIGHT) {
+            if (!f->Ka.isZero()) {
+                RGB Ka = f->Ka;
+                radiance[paths.pixel[p]] += thr * (Ka * l->L()) / light_pdf;
+            }
+        }
+        else if (l->type == POINT_LIGHT || l->type == AREA_LIGHT) {
+            RGB L;
+            Point lpoint;
+            float l_pdf = 1.f;
+            bool lit;
+            Vector Ldir;
+
+            if (l->type == POINT_LIGHT) {
+                L = l->Sample_L(NULL, &lpoint);
+                Ldir = isect.p.vec2point(lpoint);
+                Ldir.normalize();
+                lit = Ldir.dot(isect.sn) > 0.;
+            }
+            else {
+                AreaLight *al = (AreaLight *)l;
+                float rnd[2];
+                rnd[0] = sampler.get1D();
+                rnd[1] = sampler.get1D();
+                L = al->Sample_L(rnd, &lpoint, l_pdf);
+                Ldir = isect.p.vec2point(lpoint);
+                Ldir.normalize();
+                lit = Ldir.dot(isect.sn) > 0. && Ldir.dot(al->gem->normal) <= 0.;
+            }
+            if (lit) {
+                const float Ldistance = isect.p.vec2point(lpoint).norm();
+                const float cosL = Ldir.dot(isect.sn);
+                Ray shadow(isect.p, Ldir);
+                // adjust origin by an EPSILON along the normal to avoid self occlusion at the origin
+                shadow.adjustOrigin(isect.gn);
+                shadows.push(shadow, p);
+                shadows.tmax.push_back(Ldistance - EPSILON);
+                shadows.L.push_back(thr * (Kd * L * cosL) / l_pdf / light_pdf);
+            }
+        }
+    }
+
+    // continuation
+    const float continue_p = pt->getContinueProbability();
+    const float rnd_russian = sampler.get1D();
+    if (!(depth < pt->getMaxDepth() || rnd_russian < continue_p))
+        return;
+
+    // random select between specular and diffuse
+    const float s_p = f->Ks.Y() / (f->Ks.Y() + f->Kd.Y());
+    const float rnd = sampler.get1D();
+    RGB weight;
+    Vector dir;
+    bool diffuse;
+
+    if (rnd < s_p || s_p >= (1.0f - EPSILON)) {
+        diffuse = false;
+        float cos = isect.gn.dot(isect.wo);
+        Vector Rdir = 2.f * cos * isect.gn - isect.wo;
+        if (f->Ns < 1000) { // glossy: cosine lobe around the ideal reflection
+            float rnd2[2];
+            sampler.get2D(rnd2);
+            Vector S_around_N;
+            const float cos_theta = powf(rnd2[1], 1. / (f->Ns + 1.));
+            S_around_N.Z = cos_theta;
+            const float aux_r1 = powf(rnd2[1], 2. / (f->Ns + 1.));
+            S_around_N.Y = sinf(2. * M_PI * rnd2[0]) * sqrtf(1. - aux_r1);
+            S_around_N.X = cosf(2. * M_PI * rnd2[0]) * sqrtf(1. - aux_r1);
+            const float pdf = (f->Ns + 1.f) * powf(cos_theta, f->Ns) / (2.f * M_PI);
+            if (pdf <= 0.f) return;
+            Vector Rx, Ry;
+            Rdir.CoordinateSystem(&Rx, &Ry);
+            dir = S_around_N.Rotate(Rx, Ry, Rdir);
+            weight = f->Ks / pdf;
+        }
+        else { // ideal specular reflection
+            dir = Rdir;
+            weight = f->Ks;
+        }
+        weight = weight / s_p;
+    }
+    else {
+        diffuse = true;
+        float rnd2[2];
+        sampler.get2D(rnd2);
+        Vector D_around_Z;
+        const float cos_theta = D_around_Z.Z = sqrtf(rnd2[1]);
+        // a grazing sample has no density (0 / 0 weight): end the path
+        if (cos_theta <= 0.f) return;
+        D_around_Z.Y = sinf(2.0f * M_PI * rnd2[0]) * sqrtf(1.0f - rnd2[1]);
+        D_around_Z.X = cosf(2.0f * M_PI * rnd2[0]) * sqrtf(1.0f - rnd2[1]);
+        const float pdf = cos_theta / (M_PI);
+        Vector Rx, Ry;
+        isect.gn.CoordinateSystem(&Rx, &Ry);
+        dir = D_around_Z.Rotate(Rx, Ry, isect.gn);
+        weight = (f->Kd * cos_theta) / pdf / (1.0f - s_p);
+    }
+    if (depth >= pt->getMaxDepth())
+        weight = weight / continue_p;
+
+    Ray r(isect.p, dir);
+    r.adjustOrigin(isect.gn);
+    paths.throughput[p] = thr * weight;
+    paths.depth[p] = depth + 1;
+    paths.diffuseBounce[p] = diffuse;
+    next.push(r, p);
+}
+
+// render pixels [x0,x1[ x [y0,y1[: all their paths advance together
+void WavefrontRenderer::renderTile(int x0, int y0, int x1, int y1)
+{
+    const int tw = x1 - x0, th = y1 - y0;
+    const int nPaths = tw * th * spp;
+    std::vector<RGB> radiance(tw * th);
+    PathStates paths;
+    paths.pixel.resize(nPaths);
+    paths.throughput.assign(nPaths, RGB(1., 1., 1.));
+    paths.depth.assign(nPaths, 0);
+    paths.diffuseBounce.assign(nPaths, 0);
+    paths.sampler.assign(nPaths, Sampler(seed));
+
+    RayQueue current, next, shadows, tmp;
+    std::vector<Intersection> isects;
+    std::vector<uint8_t> hit;
+    long rays = 0, shadowRays = 0;
+
+    // camera rays of every pixel sample
+    int p = 0;
+    for (int y=y0 ; y<y1 ; y++) {
+        for (int x=x0 ; x<x1 ; x++) {
+            for (int ss=0 ; ss<spp ; ss++, p++) {
+                Ray primary;
+                float jitterV[2];
+                paths.pixel[p] = (y - y0) * tw + (x - x0);
+                paths.sampler[p].startPixelSample(x, y, ss);
+                paths.sampler[p].get2D(jitterV);
+                cam->GenerateRay(x, y, &primary, jitterV);
+                current.push(primary, p);
+            }
+        }
+    }
+
+    const RGB background = pt->getBackground();
+    while (current.size() > 0) {
+        if (sortRays)
+            sortQueue(current, tmp);
+
+        // intersect all
+        const int n = current.size();
+        isects.resize(n);
+        hit.resize(n);
+        for (int i=0 ; i<n ; i++)
+            hit[i] = scene->trace(current.ray(i), &isects[i]);
+        rays += n;
+
+        // shade all: emission, shadow rays and continuation rays
+        next.clear();
+        shadows.clear();
+        for (int i=0 ; i<n ; i++) {
+            if (!hit[i]) {
+                const int pp = current.path[i];
+                RGB bg = background;
+                radiance[paths.pixel[pp]] += paths.throughput[pp] * bg;
+                continue;
+            }
+            shadeHit(i, current, isects[i], paths, next, shadows, radiance);
+        }
+
+        // trace the shadow rays
+        for (int i=0 ; i<shadows.size() ; i++) {
+            if (scene->visibility(shadows.ray(i), shadows.tmax[i]))
+                radiance[paths.pixel[shadows.path[i]]] += shadows.L[i];
+        }
+        shadowRays += shadows.size();
+
+        std::swap(current, next);
+    }
+
+    // write the result into the image frame buffer (image)
+    for (int y=y0 ; y<y1 ; y++)
+        for (int x=x0 ; x<x1 ; x++)
+            img->set(x, y, radiance[(y - y0) * tw + (x - x0)] / spp);
+
+    raysTraced += rays;
+    shadowRaysTraced += shadowRays;
+}
+
+void WavefrontRenderer::Render()
+{
+    int W = 0, H = 0; // resolution
+
+    // get resolution from the camera
+    cam->getResolution(&W, &H);
+
+    // the stages only implement the shader's default estimator
+    if (pt->getMIS() || pt->getIterative()) {
+        fprintf(stderr, "Wavefront: the shader's %s estimator is not supported, rendering pixel by pixel\n",
+                pt->getIterative() ? "iterative" : "MIS");
+        StandardRenderer fallback(cam, scene, img, pt, spp, nThreads, tileSize, seed);
+        fallback.Render();
+        return;
+    }
+
+    raysTraced = shadowRaysTraced = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    const int tile = (tileSize > 0) ? tileSize : std::max(W, H);
+    if (nThreads == 1) {
+        for (int ty=0 ; ty < H ; ty += tile)
+            for (int tx=0 ; tx < W ; tx += tile)
+                renderTile(tx, ty, std::min(tx + tile, W), std::min(ty + tile, H));
+    }
+    else {
+        ThreadPool pool(nThreads);
+        for (int ty=0 ; ty < H ; ty += tile) {
+            for (int tx=0 ; tx < W ; tx += tile) {
+                const int x1 = std::min(tx + tile, W), y1 = std::min(ty + tile, H);
+                pool.submit([this, tx, ty, x1, y1] { renderTile(tx, ty, x1, y1); });
+            }
+        }
+        pool.wait();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const long total = raysTraced + shadowRaysTraced;
+    fprintf(stdout, "Wavefront: %ld rays (%ld shadow) in %.3lf secs, %.2lf Mrays/s%s\n",
+            total, shadowRaysTraced.load(), elapsed, total / elapsed * 1e-6,
+            sortRays ? ", sorted queues" : "");
+}
@@ -0,0 +1,67 @@
+//
+//  WavefrontRenderer.hpp
+//  VI-RT
+//
+
+#ifndef WavefrontRenderer_hpp
+#define WavefrontRenderer_hpp
+
+#include "renderer.hpp"
+#include "PathTracerShader.hpp"
+#include "sampler.hpp"
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+// Path tracer organised as a wavefront: all the paths of a tile advance one
+// bounce at a time through separate stages (intersect all, shade all, trace
+// the shadow rays, continue) instead of recursing pixel by pixel. Rays are
+// kept in structure of arrays queues and can be sorted by direction and
+// origin octant before each intersection stage to make them more coherent.
+// Follows PathTracerShader (same estimator, it converges to the same image)
+// but consumes the random numbers in another order. Only the shader's default
+// estimator has stages: a MIS or iterative shader is rendered pixel by pixel
+// by a StandardRenderer instead, with a warning.
+class WavefrontRenderer: public Renderer {
+private:
+    // rays waiting for one stage, one entry per path (or shadow ray)
+    struct RayQueue {
+        std::vector<float> ox, oy, oz, dx, dy, dz;
+        std::vector<int> path;      // index of the path state
+        std::vector<float> tmax;    // shadow rays only: distance to the light
+        std::vector<RGB> L;         // shadow rays only: contribution if visible
+        int size () const { return (int)path.size(); }
+        void clear ();
+        void push (const Ray &r, int p);
+        Ray ray (int i) const;
+    };
+    // state of the paths of a tile, structure of arrays
+    struct PathStates {
+        std::vector<int> pixel;     // index in the tile
+        std::vector<RGB> throughput;
+        std::vector<int> depth;
+        std::vector<uint8_t> diffuseBounce;  // last bounce was diffuse: lights are counted by direct lighting
+        std::vector<Sampler> sampler;        // random stream of the path's pixel sample
+    };
+
+    PathTracerShader *pt;
+    int spp;
+    int nThreads;       // 1 : serial path, 0 : one thread per core
+    int tileSize;
+    uint64_t seed;
+    bool sortRays;      // sort the ray queue by octants before each intersection stage
+    std::atomic<long> raysTraced, shadowRaysTraced;
+
+    void renderTile (int x0, int y0, int x1, int y1);
+    void sortQueue (RayQueue &q, RayQueue &tmp);
+    void shadeHit (int i, const RayQueue &rays, const Intersection &isect, PathStates &paths,
+                   RayQueue &next, RayQueue &shadows, std::vector<RGB> &radiance);
+public:
+    WavefrontRenderer (Camera *cam, Scene * scene, Image * img, PathTracerShader *shd, int _spp,
+                       int _nThreads=0, int _tileSize=16, uint64_t _seed=0, bool _sortRays=true):
+        Renderer(cam, scene, img, shd), pt(shd), spp(_spp), nThreads(_nThreads), tileSize(_tileSize),
+        seed(_seed), sortRays(_sortRays), raysTraced(0), shadowRaysTraced(0) {}
+    void Render ();
+};
+
+#endif /* WavefrontRenderer_hpp */
@@ -9,6 +9,7 @@
 #include "linmath.h"
 #include "ImagePPM.hpp"
 #include "perspective.hpp"
+#include "sampler.hpp"
 
 const bool jitter = true;
 
@@ -36,6 +37,7 @@ void WindowRenderer::calculateBuffers()
     cam->getResolution(&W, &H);
 
     Image *localImg = new Image(W, H);
+    Sampler sampler;
     RGB localAverage;
     localAverage = RGB(0, 0, 0);
 
@@ -59,12 +61,13 @@ void WindowRenderer::calculateBuffers()
                 Intersection isect;
                 bool intersected;
                 RGB color = RGB(0, 0, 0);
-                
+
+                sampler.startPixelSample(x, y, spp);
+
                 if (jitter)
                 {
                     float jitterV[2];
-                    jitterV[0] = ((float)rand()) / ((float)RAND_MAX);
-                    jitterV[1] = ((float)rand()) / ((float)RAND_MAX);
+                    sampler.get2D(jitterV);
                     cam->GenerateRay(x, y, &primary, jitterV);
                 }
                 else
@@ -76,7 +79,7 @@ void WindowRenderer::calculateBuffers()
                 intersected = scene->trace(primary, &isect);
 
                 // shade this intersection (shader) - remember: depth=0
-                color = shd->shade(intersected, isect, 0);
+                color = shd->shade(intersected, isect, 0, sampler);
 
                 // if (x==400 && y==300)
                 //     printf("Color (0,0): %f %f %f\n\n", color.R, color.G, color.B);
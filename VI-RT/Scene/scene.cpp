@@ -16,10 +16,16 @@
 #include <iostream>
 #include <set>
 #include <vector>
+#include <chrono>
+#include <math.h>
 #include "AreaLight.hpp"
 #include "AccelStruct.hpp"
 #include "HierarchicalGrid.hpp"
+#include "UniformGrid.hpp"
 #include "BVH.hpp"
+#include "BVH4.hpp"
+#include "MeshBVH.hpp"
+#include "instance.hpp"
 
 using namespace tinyobj;
 
@@ -27,6 +33,8 @@ Scene::Scene () {
     this->numBRDFs = 0;
     this->numLights = 0;
     this->numPrimitives = 0;
+    this->accelStructBuilt = false;
+    this->lightSampling = LIGHTS_BVH;
     // this->accelStruct = new HierarchicalGrid(3);
     this->accelStruct = new BVH();
 }
@@ -35,9 +43,19 @@ Scene::Scene (bool generateAccelStruct) {
     this->numBRDFs = 0;
     this->numLights = 0;
     this->numPrimitives = 0;
+    this->accelStructBuilt = false;
+    this->lightSampling = LIGHTS_BVH;
     if (generateAccelStruct) {
         // this->accelStruct = new HierarchicalGrid(3);
-        this->accelStruct = new BVH(1);
+        // this->accelStruct = new UniformGrid();
+        // this->accelStruct = new BVH(1, SPLIT_MEDIAN);
+        // this->accelStruct = new BVH(1, SPLIT_SAH);
+        // this->accelStruct = new BVH(1, SPLIT_LBVH);   // fastest to rebuild
+        // this->accelStruct = new BVH(1, SPLIT_HLBVH);
+        // this->accelStruct = new BVH(0, SPLIT_SAH);    // top level over the primitives
+        // scenes with instances (Load(.., true)) get a top level BVH instead,
+        // see BuildAccelStruct
+        this->accelStruct = new BVH4(SPLIT_SAH);
     }
     else {
         this->accelStruct = nullptr;
@@ -87,10 +105,33 @@ static void PrintInfo(const ObjReader myObj)
  https://github.com/tinyobjloader/tinyobjloader
  */
 
-bool Scene::Load(const std::string &fname)
+// is b a translated copy of a (same faces, same vertices up to an offset)?
+static bool translatedCopy(Mesh *a, Mesh *b, Vector *offset)
+{
+    if (a->numVertices != b->numVertices || a->numFaces != b->numFaces || a->numVertices == 0)
+        return false;
+    for (int f = 0; f < a->numFaces; f++)
+        for (int v = 0; v < 3; v++)
+            if (a->faces[f].vert_ndx[v] != b->faces[f].vert_ndx[v])
+                return false;
+
+    *offset = a->vertices[0].vec2point(b->vertices[0]);
+    const float tol = 1e-5f * (a->bb.min.vec2point(a->bb.max).norm() + offset->norm());
+    for (int v = 1; v < a->numVertices; v++)
+    {
+        Vector d = a->vertices[v].vec2point(b->vertices[v]) - *offset;
+        if (fabsf(d.X) > tol || fabsf(d.Y) > tol || fabsf(d.Z) > tol)
+            return false;
+    }
+    return true;
+}
+
+bool Scene::Load(const std::string &fname, bool instancing)
 {
     ObjReader myObjReader;
     int FaceID = 0;
+    std::vector<Mesh *> uniqueMeshes;   // with instancing
+    int nInstances = 0;
 
     if (!myObjReader.ParseFromFile(fname))
     {
@@ -127,6 +168,11 @@ bool Scene::Load(const std::string &fname)
         mat->Kt.G = it->transmittance[1];
         mat->Kt.B = it->transmittance[2];
 
+        // Ke
+        mat->Ke.R = it->emission[0];
+        mat->Ke.G = it->emission[1];
+        mat->Ke.B = it->emission[2];
+
         BRDFs.push_back(mat);
         numBRDFs++;
     }
@@ -141,6 +187,33 @@ bool Scene::Load(const std::string &fname)
     // iterate over shapes (meshes)
     for (auto shp = shps.begin(); shp != shps.end(); shp++)
     {
+        // material_ids has one entry per face: skip shapes without faces
+        if (shp->mesh.material_ids.empty() || shp->mesh.indices.empty())
+            continue;
+
+        // emissive shapes become one area light per face
+        if (shp->mesh.material_ids[0] >= 0)
+        {
+            RGB Ke = ((Phong *)BRDFs[shp->mesh.material_ids[0]])->Ke;
+            if (!Ke.isZero())
+            {
+                for (auto v_it = shp->mesh.indices.begin(); v_it != shp->mesh.indices.end(); v_it += 3)
+                {
+                    Point v[3];
+                    for (int i = 0; i < 3; i++)
+                    {
+                        const int objNdx = (v_it + i)->vertex_index;
+                        v[i].set(vtcs[objNdx * 3], vtcs[objNdx * 3 + 1], vtcs[objNdx * 3 + 2]);
+                    }
+                    Vector normal = v[0].vec2point(v[1]).cross(v[0].vec2point(v[2]));
+                    normal.normalize();
+                    lights.push_back(new AreaLight(Ke, v[0], v[1], v[2], normal));
+                    numLights++;
+                }
+                continue;
+            }
+        }
+
         Primitive *p = new Primitive;
         Mesh *m = new Mesh;
         p->g = m;
@@ -203,27 +276,198 @@ bool Scene::Load(const std::string &fname)
             m->faces.push_back(*f);
             m->numFaces++;
         } // end iterate vértices in the mesh (shape)
+        if (instancing)
+        {
+            // a translated copy of an earlier mesh becomes an instance of it
+            Mesh *orig = nullptr;
+            Vector offset;
+            for (Mesh *u : uniqueMeshes)
+            {
+                if (translatedCopy(u, m, &offset))
+                {
+                    orig = u;
+                    break;
+                }
+            }
+            if (orig)
+            {
+                delete m;
+                AddInstance(orig, p->material_ndx, Transform::translate(offset));
+            }
+            else
+            {
+                uniqueMeshes.push_back(m);
+                AddInstance(m, p->material_ndx, Transform());
+            }
+            nInstances++;
+            delete p;
+            continue;
+        }
+        // without an acceleration structure rays are traced mesh by mesh
+        if (!accelStruct)
+            m->buildBVH();
         // add primitive to scene
         prims.push_back(p);
         numPrimitives++;
     } // end iterate over shapes
 
-    if (this->accelStruct) {
-        clock_t start, end;
-        double cpu_time_used;
+    if (instancing)
+    {
+        size_t bytes = 0;
+        for (Mesh *u : uniqueMeshes)
+            bytes += meshBVHs[u]->memory();
+        printf("Instancing: %d meshes, %lu unique (%.1lf KB of mesh BVHs)\n", nInstances, uniqueMeshes.size(),
+               bytes / 1024.);
+    }
+    return true;
+}
 
-        printf("Starting Acceleration Structure Building..\n");
-        start = clock();
-        this->accelStruct->build(this);
-        end = clock();
-        cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC;
-        printf("Finished Building Acceleration Structure in %.5lf secs\n", cpu_time_used);
+Primitive *Scene::AddMesh(Mesh *mesh, int material_ndx)
+{
+    if (!accelStruct)
+        mesh->buildBVH();
+    Primitive *p = new Primitive;
+    p->g = mesh;
+    p->material_ndx = material_ndx;
+    prims.push_back(p);
+    numPrimitives++;
+    return p;
+}
+
+Primitive *Scene::AddInstance(Mesh *mesh, int material_ndx, const Transform &toWorld)
+{
+    MeshBVH *&blas = meshBVHs[mesh];
+    if (!blas)
+        blas = new MeshBVH(mesh);
+    Primitive *p = new Primitive;
+    p->g = new Instance(mesh, blas, toWorld);
+    p->material_ndx = material_ndx;
+    prims.push_back(p);
+    numPrimitives++;
+    return p;
+}
+
+// emitted power of each light: radiance * area * pi for area lights,
+// intensity * 4 pi for point lights and, for the ambient light, the
+// irradiance (pi * radiance) it gives a surface
+void Scene::BuildLightDistribution()
+{
+    std::vector<float> power(lights.size(), 0.f);
+    for (size_t l = 0; l < lights.size(); l++)
+    {
+        switch (lights[l]->type)
+        {
+        case AREA_LIGHT:
+            power[l] = lights[l]->L().Y() * (float)M_PI / ((AreaLight *)lights[l])->areaPdf;
+            break;
+        case POINT_LIGHT:
+            power[l] = lights[l]->L().Y() * 4.f * (float)M_PI;
+            break;
+        case AMBIENT_LIGHT:
+            power[l] = lights[l]->L().Y() * (float)M_PI;
+            break;
+        default:
+            break;
+        }
     }
+    lightDistribution.build(power);
+    lightBVH.build(lights, power);
+}
 
-    return true;
+int Scene::sampleLight(const Point &p, const Vector &n, float u, float *pdf)
+{
+    // lights added after BuildAccelStruct are picked uniformly
+    const bool stale = lightDistribution.size() != (int)lights.size();
+    if (lightSampling == LIGHTS_UNIFORM || stale)
+    {
+        const int count = (int)lights.size();
+        const int l = (int)(u * count);
+        *pdf = 1.f / (float)count;
+        return (l < count) ? l : count - 1;
+    }
+    if (lightSampling == LIGHTS_BVH)
+        return lightBVH.sample(p, n, u, pdf);
+    return lightDistribution.sample(u, pdf);
+}
+
+float Scene::lightPdf(int l, const Point &p, const Vector &n)
+{
+    const bool stale = lightDistribution.size() != (int)lights.size();
+    if (lightSampling == LIGHTS_UNIFORM || stale)
+        return 1.f / (float)lights.size();
+    if (lightSampling == LIGHTS_BVH)
+        return lightBVH.pdf(l, p, n);
+    return lightDistribution.pdf(l);
 }
 
-bool Scene::trace(Ray r, Intersection *isect)
+void Scene::BuildAccelStruct()
+{
+    BuildLightDistribution();
+    if (!this->accelStruct)
+        return;
+
+    // the triangle level structures would copy the triangles of every
+    // instance: scenes with instances are traced by a top level BVH over the
+    // primitives, so that instances share their mesh BVH
+    bool instanced = false;
+    for (auto p : prims)
+        if (dynamic_cast<Instance *>(p->g))
+        {
+            instanced = true;
+            break;
+        }
+    if (instanced && !this->accelStruct->tracesInstances())
+    {
+        printf("Instances: tracing with a top level BVH\n");
+        delete this->accelStruct;
+        this->accelStruct = new BVH(0, SPLIT_SAH);
+    }
+    // under a top level BVH each mesh is traced by its own BVH
+    if (this->accelStruct->tracesInstances())
+    {
+        for (auto p : prims)
+        {
+            Mesh *m = dynamic_cast<Mesh *>(p->g);
+            if (m && !m->hasBVH())
+                m->buildBVH();
+        }
+    }
+
+    // area lights are traced as part of the acceleration structure
+    for (auto l : lightPrims)
+        delete l;
+    lightPrims.clear();
+    for (size_t l = 0; l < lights.size(); l++)
+    {
+        if (lights[l]->type == AREA_LIGHT)
+        {
+            Primitive *p = new Primitive;
+            p->g = ((AreaLight *)lights[l])->gem;
+            p->light_ndx = (int)l;
+            lightPrims.push_back(p);
+        }
+    }
+
+    // wall clock time: clock() adds up the time of all the builder threads
+    printf("Starting Acceleration Structure Building..\n");
+    auto start = std::chrono::steady_clock::now();
+    this->accelStruct->build(this);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Finished Building Acceleration Structure in %.5lf secs\n", elapsed);
+    accelStructBuilt = true;
+}
+
+bool Scene::UpdateAccelStruct()
+{
+    if (!accelStructBuilt)
+    {
+        BuildAccelStruct();
+        return false;
+    }
+    return this->accelStruct->refit();
+}
+
+bool Scene::trace(const Ray &r, Intersection *isect)
 {
     Intersection curr_isect;
     bool intersection = false;
@@ -231,8 +475,11 @@ bool Scene::trace(Ray r, Intersection *isect)
     if (numPrimitives == 0)
         return false;
 
-    if (accelStruct) {
-        intersection = this->accelStruct->trace(r, isect);
+    if (accelStructBuilt) {
+        // light sources are part of the acceleration structure;
+        // shaders read isLight even when nothing is hit
+        isect->isLight = false;
+        return this->accelStruct->trace(r, isect);
     }
     else {
         // iterate over all primitives
@@ -270,12 +517,14 @@ bool Scene::trace(Ray r, Intersection *isect)
                     *isect = curr_isect;
                     isect->isLight = true;
                     isect->Le = al->L();
+                    isect->light_ndx = (int)(l - lights.begin());
                 }
                 else if (curr_isect.depth < isect->depth)
                 {
                     *isect = curr_isect;
                     isect->isLight = true;
                     isect->Le = al->L();
+                    isect->light_ndx = (int)(l - lights.begin());
                 }
             }
         }
@@ -284,29 +533,46 @@ bool Scene::trace(Ray r, Intersection *isect)
     return intersection;
 }
 
+void Scene::traceRays(RayPacket8 &packet, IntersectionPacket8 &isects)
+{
+    if (accelStructBuilt && numPrimitives > 0) {
+        for (int k = 0; k < packet.n; k++)
+            isects.isect[k].isLight = false;
+        this->accelStruct->traceRays(packet, isects);
+        return;
+    }
+    for (int k = 0; k < packet.n; k++)
+        isects.hit[k] = trace(packet.rays[k], &isects.isect[k]);
+}
+
 // checks whether a point on a light source (distance maxL) is visible
-bool Scene::visibility(Ray s, const float maxL)
+bool Scene::visibility(const Ray &s, const float maxL)
 {
     bool visible = true;
-    Intersection curr_isect;
 
     if (numPrimitives == 0)
         return true;
 
+    if (accelStructBuilt)
+        return !accelStruct->occluded(s, maxL);
+
     // iterate over all primitives while visible
     for (auto prim_itr = prims.begin(); prim_itr != prims.end() && visible; prim_itr++)
     {
-        if ((*prim_itr)->g->intersect(s, &curr_isect))
+        if ((*prim_itr)->g->occluded(s, maxL))
         {
-            if (curr_isect.depth < maxL)
-            {
-                visible = false;
-            }
+            visible = false;
         }
     }
     return visible;
 }
 
+void Scene::printAccelStats()
+{
+    if (accelStructBuilt)
+        accelStruct->printStats();
+}
+
 void Scene::printScene()
 {
     std::cout << "#materials = " << numBRDFs << " ;" << std::endl;
@@ -14,13 +14,21 @@
 #include "primitive.hpp"
 #include "light.hpp"
 #include "ray.hpp"
+#include "RayPacket.hpp"
 #include "intersection.hpp"
 #include "BRDF.hpp"
+#include "mesh.hpp"
+#include "transform.hpp"
+#include "AliasTable.hpp"
+#include "LightBVH.hpp"
+#include <map>
 
 class HierarchicalGrid;
 
 class AccelStruct;
 
+class MeshBVH;
+
 class rehash {
 public:
     int objNdx, ourNdx;
@@ -29,28 +37,70 @@ public:
     }
 };
 
+// how the shaders pick the light to sample at a shading point
+enum LightSampling {
+    LIGHTS_UNIFORM = 0,     // all lights alike
+    LIGHTS_POWER = 1,       // by power (alias table)
+    LIGHTS_BVH = 2          // by estimated contribution at the point (light BVH)
+};
+
 class Scene {
     std::vector <Primitive *> prims;
+    std::vector <Primitive *> lightPrims;  // area light geometry, built with the accel structure
     std::vector <BRDF *> BRDFs;
     AccelStruct *accelStruct;
+    bool accelStructBuilt;
+    std::map<Mesh *, MeshBVH *> meshBVHs;  // bottom level BVH of each instanced mesh
+    // light sampling structures, built with the accel structure
+    LightSampling lightSampling;
+    AliasTable lightDistribution;          // lights by power
+    LightBVH lightBVH;
+    void BuildLightDistribution (void);
 public:
     std::vector <Light *> lights;
     int numPrimitives, numLights, numBRDFs;
 
     Scene ();
     Scene (bool generateAccelStruct);
-    bool Load (const std::string &fname);
+    // with instancing, meshes that are translated copies of an earlier one are
+    // loaded as instances of it (see AddInstance); scenes with instances are
+    // traced by a top level BVH whatever the acceleration structure chosen
+    bool Load (const std::string &fname, bool instancing=false);
+    // add an instance of mesh placed by toWorld: the mesh and its bottom
+    // level BVH are shared by all its instances
+    Primitive *AddInstance (Mesh *mesh, int material_ndx, const Transform &toWorld);
+    Primitive *AddMesh (Mesh *mesh, int material_ndx);
     bool SetLights (void) { return true; };
-    bool trace (Ray r, Intersection *isect);
-    bool visibility (Ray s, const float maxL);
+    // build the acceleration structure over the primitives and the area lights;
+    // call after all lights are added, until then rays are traced brute force
+    void BuildAccelStruct (void);
+    // after moving mesh vertices (and calling Mesh::updateGeometry):
+    // refit the acceleration structure, or rebuild it if the refit degrades
+    // it too much; returns false if it was rebuilt
+    bool UpdateAccelStruct (void);
+    bool trace (const Ray &r, Intersection *isect);
+    // trace a packet of coherent rays (closest hit of each)
+    void traceRays (RayPacket8 &packet, IntersectionPacket8 &isects);
+    bool visibility (const Ray &s, const float maxL);
+    // light sampling strategy, LIGHTS_BVH by default
+    void SetLightSampling (LightSampling s) { lightSampling = s; }
+    LightSampling GetLightSampling (void) { return lightSampling; }
+    // pick a light to sample at point p with shading normal n, given a
+    // uniform u in [0,1[; returns its index and the probability in *pdf,
+    // or -1 if no light can reach p
+    int sampleLight (const Point &p, const Vector &n, float u, float *pdf);
+    // probability that sampleLight picks light l at p
+    float lightPdf (int l, const Point &p, const Vector &n);
     void printSummary(void) {
         std::cout << "#primitives = " << numPrimitives << " ; ";
         std::cout << "#lights = " << numLights << " ; ";
         std::cout << "#materials = " << numBRDFs << " ;" << std::endl;
     }
     std::vector <Primitive *> getPrims() {return this->prims;}
+    std::vector <Primitive *> getLightPrims() {return this->lightPrims;}
     BRDF *getMaterial(int indx) { return BRDFs[indx]; }
     void printScene();
+    void printAccelStats();
 };
 
 #endif /* Scene_hpp */
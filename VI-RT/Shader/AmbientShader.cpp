@@ -8,7 +8,7 @@
 #include "AmbientShader.hpp"
 #include "Phong.hpp"
 
-RGB AmbientShader::shade(bool intersected, Intersection isect, int depth) {
+RGB AmbientShader::shade(bool intersected, const Intersection &isect, int depth, Sampler &sampler) {
     RGB color(0.,0.,0.);
     // if no intersection, return background
     if (!intersected) {
@@ -14,7 +14,7 @@ class AmbientShader: public Shader {
     RGB background;
 public:
     AmbientShader (Scene *scene, RGB bg): background(bg), Shader(scene) {}
-    RGB shade (bool intersected, Intersection isect, int depth);
+    RGB shade (bool intersected, const Intersection &isect, int depth, Sampler &sampler);
 };
 
 #endif /* AmbientShader_hpp */
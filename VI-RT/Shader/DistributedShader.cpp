@@ -14,14 +14,16 @@
 
 // #include "DEB.h"
 
-RGB DistributedShader::directLighting(Intersection isect, Phong *f)
+RGB DistributedShader::directLighting(const Intersection &isect, Phong *f, Sampler &sampler)
 {
     RGB color(0., 0., 0.);
     Light *l;
 
-    int l_idx = (int)(((float)rand())/RAND_MAX * scene->numLights);
-    if (l_idx >= scene->numLights)
-        l_idx = scene->numLights-1;
+    // one light, picked by the scene's light sampling strategy
+    float light_pdf;
+    const int l_idx = scene->sampleLight(isect.p, isect.sn, sampler.get1D(), &light_pdf);
+    if (l_idx < 0)
+        return color;   // no light reaches this point
 
     l = scene->lights.at(l_idx);
 
@@ -89,8 +91,8 @@ RGB DistributedShader::directLighting(Intersection isect, Phong *f)
                 float l_pdf;
                 AreaLight *al = (AreaLight *)l;
                 float rnd[2];
-                rnd[0] = ((float)rand()) / ((float)RAND_MAX);
-                rnd[1] = ((float)rand()) / ((float)RAND_MAX);
+                rnd[0] = sampler.get1D();
+                rnd[1] = sampler.get1D();
                 L = al->Sample_L(rnd, &lpoint, l_pdf);
                 // compute the direction from the intersection point to the light source
                 Vector Ldir = isect.p.vec2point(lpoint);
@@ -124,10 +126,10 @@ RGB DistributedShader::directLighting(Intersection isect, Phong *f)
         color += this_l_color;
 
     } // for loop
-    return color;
+    return color / light_pdf;
 }
 
-RGB DistributedShader::specularReflection(Intersection isect, Phong *f, int depth)
+RGB DistributedShader::specularReflection(const Intersection &isect, Phong *f, int depth, Sampler &sampler)
 {
     RGB color(0., 0., 0.);
     Vector Rdir, s_dir;
@@ -147,8 +149,8 @@ RGB DistributedShader::specularReflection(Intersection isect, Phong *f, int dept
         // following item (36) of the Global illumination compendium
         // get 2 random number in [0,1[
         float rnd[2];
-        rnd[0] = ((float)rand()) / ((float)RAND_MAX);
-        rnd[1] = ((float)rand()) / ((float)RAND_MAX);
+        rnd[0] = sampler.get1D();
+        rnd[1] = sampler.get1D();
 
         Vector S_around_N;
         const float cos_theta = powf(rnd[1], 1. / (f->Ns + 1.));
@@ -183,7 +185,7 @@ RGB DistributedShader::specularReflection(Intersection isect, Phong *f, int dept
         intersected = scene->trace(specular, &s_isect);
 
         // shade this intersection
-        RGB Rcolor = shade(intersected, s_isect, depth + 1);
+        RGB Rcolor = shade(intersected, s_isect, depth + 1, sampler);
 
         // color = (f->Ks * cos_pow * Rcolor) /pdf ;
         color = (f->Ks * Rcolor) / pdf;
@@ -207,14 +209,14 @@ RGB DistributedShader::specularReflection(Intersection isect, Phong *f, int dept
         intersected = scene->trace(specular, &s_isect);
 
         // shade this intersection
-        RGB Rcolor = shade(intersected, s_isect, depth + 1);
+        RGB Rcolor = shade(intersected, s_isect, depth + 1, sampler);
 
         color = (f->Ks * Rcolor);
         return color;
     }
 }
 
-RGB DistributedShader::shade(bool intersected, Intersection isect, int depth)
+RGB DistributedShader::shade(bool intersected, const Intersection &isect, int depth, Sampler &sampler)
 {
     RGB color(0., 0., 0.);
 
@@ -235,13 +237,13 @@ RGB DistributedShader::shade(bool intersected, Intersection isect, int depth)
     // if there is a specular component sample it
     if (!f->Ks.isZero() && depth < 4)
     {
-        color += specularReflection(isect, f, depth + 1);
+        color += specularReflection(isect, f, depth + 1, sampler);
     }
 
     // if there is a diffuse component do direct light
     if (!f->Kd.isZero())
     {
-        color += directLighting(isect, f);
+        color += directLighting(isect, f, sampler);
     }
 
     return color;
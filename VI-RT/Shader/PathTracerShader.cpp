@@ -9,12 +9,13 @@
 #include "Phong.hpp"
 #include "ray.hpp"
 #include "AreaLight.hpp"
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 
 // #include "DEB.h"
 
-RGB PathTracerShader::directLighting(Intersection isect, Phong *f)
+RGB PathTracerShader::directLighting(const Intersection &isect, Phong *f, Sampler &sampler)
 {
 
     RGB color(0., 0., 0.);
@@ -31,10 +32,11 @@ RGB PathTracerShader::directLighting(Intersection isect, Phong *f)
         // if random sampling reaasign l
         if (RANDOM_SAMPLE_ONE)
         {
-            // randomly select one light source
-            l_ndx = rand() % scene->numLights;
+            // select one light source with probability proportional to its power
+            l_ndx = scene->sampleLight(isect.p, isect.sn, sampler.get1D(), &light_pdf);
+            if (l_ndx < 0)
+                break;  // no light reaches this point
             l = scene->lights[l_ndx];
-            light_pdf = 1.f / ((float)scene->numLights);
         }
 
         if (l->type == AMBIENT_LIGHT)
@@ -98,8 +100,8 @@ RGB PathTracerShader::directLighting(Intersection isect, Phong *f)
                 // get the position and radiance of the light source
                 // get 2 random number in [0,1[
                 float rnd[2];
-                rnd[0] = ((float)rand()) / ((float)RAND_MAX);
-                rnd[1] = ((float)rand()) / ((float)RAND_MAX);
+                rnd[0] = sampler.get1D();
+                rnd[1] = sampler.get1D();
                 L = al->Sample_L(rnd, &lpoint, l_pdf);
 
                 // compute the direction from the intersection point to the light source
@@ -151,7 +153,7 @@ RGB PathTracerShader::directLighting(Intersection isect, Phong *f)
     return color;
 }
 
-RGB PathTracerShader::specularReflection(Intersection isect, Phong *f, int depth)
+RGB PathTracerShader::specularReflection(const Intersection &isect, Phong *f, int depth, Sampler &sampler)
 {
     RGB color(0., 0., 0.);
     Vector Rdir, s_dir;
@@ -171,8 +173,8 @@ RGB PathTracerShader::specularReflection(Intersection isect, Phong *f, int depth
         // following item (36) of the Global illumination compendium
         // get 2 random number in [0,1[
         float rnd[2];
-        rnd[0] = ((float)rand()) / ((float)RAND_MAX);
-        rnd[1] = ((float)rand()) / ((float)RAND_MAX);
+        rnd[0] = sampler.get1D();
+        rnd[1] = sampler.get1D();
 
         Vector S_around_N;
         const float cos_theta = powf(rnd[1], 1. / (f->Ns + 1.));
@@ -207,7 +209,7 @@ RGB PathTracerShader::specularReflection(Intersection isect, Phong *f, int depth
         intersected = scene->trace(specular, &s_isect);
 
         // shade this intersection
-        RGB Rcolor = shade(intersected, s_isect, depth + 1);
+        RGB Rcolor = shade(intersected, s_isect, depth + 1, sampler);
 
         // color = (f->Ks * cos_pow * Rcolor) /pdf ;
         color = (f->Ks * Rcolor) / pdf;
@@ -225,13 +227,13 @@ RGB PathTracerShader::specularReflection(Intersection isect, Phong *f, int depth
         specular.adjustOrigin(isect.gn);
         // trace ray
         bool intersected = scene->trace(specular, &s_isect);
-        RGB Rcolor = shade(intersected, s_isect, depth + 1);
+        RGB Rcolor = shade(intersected, s_isect, depth + 1, sampler);
         color = (f->Ks * Rcolor);
         return color;
     }
 }
 
-RGB PathTracerShader::diffuseReflection(Intersection isect, Phong *f, int depth)
+RGB PathTracerShader::diffuseReflection(const Intersection &isect, Phong *f, int depth, Sampler &sampler)
 {
     RGB color(0., 0., 0.);
     Vector dir;
@@ -242,8 +244,8 @@ RGB PathTracerShader::diffuseReflection(Intersection isect, Phong *f, int depth)
     // actual direction distributed around N
     // get 2 random number in [0,1[
     float rnd[2];
-    rnd[0] = ((float)rand()) / ((float)RAND_MAX);
-    rnd[1] = ((float)rand()) / ((float)RAND_MAX);
+    rnd[0] = sampler.get1D();
+    rnd[1] = sampler.get1D();
 
     Vector D_around_Z;
     // cosine sampling
@@ -251,6 +253,8 @@ RGB PathTracerShader::diffuseReflection(Intersection isect, Phong *f, int depth)
     D_around_Z.Y = sinf(2.0f * M_PI * rnd[0]) * sqrtf(1.0f - rnd[1]);
     D_around_Z.X = cosf(2.0f * M_PI * rnd[0]) * sqrtf(1.0f - rnd[1]);
     pdf = cos_theta / (M_PI);
+    if (pdf <= 0.f)     // grazing direction, rnd[1] == 0
+        return color;
 
     // generate a coordinate system from N
     Vector Rx, Ry;
@@ -276,14 +280,14 @@ RGB PathTracerShader::diffuseReflection(Intersection isect, Phong *f, int depth)
 
     if (!d_isect.isLight)
     { // if light source return 0 ; handled by direct
-        RGB Rcolor = shade(intersected, d_isect, depth + 1);
+        RGB Rcolor = shade(intersected, d_isect, depth + 1, sampler);
 
         color = (f->Kd * cos_theta * Rcolor) / pdf;
     }
     return color;
 }
 
-RGB PathTracerShader::shade(bool intersected, Intersection isect, int depth)
+RGB PathTracerShader::shade(bool intersected, const Intersection &isect, int depth, Sampler &sampler)
 {
     RGB color(0., 0., 0.);
 
@@ -301,19 +305,24 @@ RGB PathTracerShader::shade(bool intersected, Intersection isect, int depth)
     // get the BRDF
     Phong *f = (Phong *)isect.f;
 
-    float rnd_russioan = ((float)rand()) / ((float)RAND_MAX);
+    if (iterative)
+        return shadeIterative(isect, sampler);
+    if (mis)
+        return shadeMIS(isect, f, depth, sampler);
+
+    float rnd_russioan = sampler.get1D();
     if (depth < MAX_DEPTH || rnd_russioan < continue_p)
     {
         RGB lcolor;
 
         // random select between specular and diffuse
         float s_p = f->Ks.Y() / (f->Ks.Y() + f->Kd.Y());
-        float rnd = ((float)rand()) / ((float)RAND_MAX);
+        float rnd = sampler.get1D();
 
-        if (rnd <= s_p || s_p >= (1.0f - EPSILON)) // do specular
-            lcolor = specularReflection(isect, f, depth) / s_p;
+        if (rnd < s_p || s_p >= (1.0f - EPSILON)) // do specular
+            lcolor = specularReflection(isect, f, depth, sampler) / s_p;
         else
-            lcolor = diffuseReflection(isect, f, depth) / (1.0f - s_p);
+            lcolor = diffuseReflection(isect, f, depth, sampler) / (1.0f - s_p);
 
         if (depth < MAX_DEPTH)
             color += lcolor;
@@ -324,8 +333,254 @@ RGB PathTracerShader::shade(bool intersected, Intersection isect, int depth)
     // if there is a diffuse component do direct light
     if (!f->Kd.isZero())
     {
-        color += directLighting(isect, f);
+        color += directLighting(isect, f, sampler);
     }
 
     return color;
 };
+
+// power heuristic (beta = 2) weight of a sample of density pa, combined with
+// a strategy of density pb (Veach, 1997, sec 9.2)
+static float powerHeuristic(float pa, float pb)
+{
+    const float a2 = pa * pa, b2 = pb * pb;
+    return (a2 + b2 > 0.f) ? a2 / (a2 + b2) : 0.f;
+}
+
+float PathTracerShader::lightPdf(int l, const Point &x, const Vector &n, const Point &p)
+{
+    if (scene->lights[l]->type != AREA_LIGHT) return 0.f;
+    // one light picked by the scene, then a uniform point on it
+    return ((AreaLight *)scene->lights[l])->pdf(x, p) * scene->lightPdf(l, x, n);
+}
+
+// light sampling half of MIS: one light, a point on it, weighted against the
+// chance that BRDF sampling finds the same direction
+RGB PathTracerShader::directLightingMIS(const Intersection &isect, Phong *f, Sampler &sampler)
+{
+    float light_pdf;
+    const int l_ndx = scene->sampleLight(isect.p, isect.sn, sampler.get1D(), &light_pdf);
+    if (l_ndx < 0) return RGB();
+    Light *l = scene->lights[l_ndx];
+
+    if (l->type == AMBIENT_LIGHT)
+        return f->Ka.isZero() ? RGB() : RGB(f->Ka * l->L() / light_pdf);
+
+    Point lpoint;
+    float rnd[2];
+    sampler.get2D(rnd);
+    RGB L;
+    if (l->type == POINT_LIGHT)
+        L = l->Sample_L(NULL, &lpoint);
+    else if (l->type == AREA_LIGHT) {
+        float l_pdf;
+        l->Sample_L(rnd, &lpoint, l_pdf);
+        L = l->L();
+    }
+    else
+        return RGB();
+
+    Vector Ldir = isect.p.vec2point(lpoint);
+    const float Ldistance = Ldir.norm();
+    Ldir.normalize();
+    const float cosL = Ldir.dot(isect.sn);
+    if (cosL <= 0.f) return RGB();
+
+    // point lights are a delta: light sampling is the only way to find them
+    float pdf = light_pdf, weight = 1.f;
+    if (l->type == AREA_LIGHT) {
+        pdf = light_pdf * ((AreaLight *)l)->pdf(isect.p, lpoint);
+        if (pdf <= 0.f) return RGB();   // behind the light
+        weight = powerHeuristic(pdf, f->pdf(Ldir, isect.wo, isect.sn));
+    }
+    else
+        L = L / (Ldistance * Ldistance);
+
+    const RGB fr = f->f(Ldir, isect.wo, isect.sn);
+    if (fr.isZero()) return RGB();
+
+    Ray shadow(isect.p, Ldir);
+    shadow.pix_x = isect.pix_x;
+    shadow.pix_y = isect.pix_y;
+    shadow.FaceID = isect.FaceID;
+    shadow.adjustOrigin(isect.gn);
+    if (!scene->visibility(shadow, Ldistance - EPSILON))
+        return RGB();
+    return fr * L * (cosL * weight / pdf);
+}
+
+// sample the BRDF: pick a lobe by luminance, then a direction around its
+// axis; *weight is f cos / pdf (Ks / s_p for a mirror, a delta: *pdf is 0).
+// Returns false if there is no direction to follow
+bool PathTracerShader::sampleBRDF(const Intersection &isect, Phong *f, Sampler &sampler, Vector *dir, RGB *weight,
+                                  float *pdf, bool *delta)
+{
+    const float s_p = f->specularProbability();
+    const bool specular = sampler.get1D() < s_p;
+    float rnd[2];
+    sampler.get2D(rnd);
+
+    Vector axis, around;
+    if (specular) {
+        axis = 2.f * isect.sn.dot(isect.wo) * isect.sn - isect.wo;
+        if (f->isMirror())
+            around = Vector(0., 0., 1.);
+        else {
+            const float cos_theta = powf(rnd[1], 1.f / (f->Ns + 1.f));
+            const float sin_theta = sqrtf(std::max(0.f, 1.f - cos_theta * cos_theta));
+            around = Vector(cosf(2.f * M_PI * rnd[0]) * sin_theta, sinf(2.f * M_PI * rnd[0]) * sin_theta, cos_theta);
+        }
+    }
+    else {
+        axis = isect.sn;
+        around = Vector(cosf(2.f * M_PI * rnd[0]) * sqrtf(1.f - rnd[1]),
+                        sinf(2.f * M_PI * rnd[0]) * sqrtf(1.f - rnd[1]), sqrtf(rnd[1]));
+    }
+    Vector Rx, Ry;
+    axis.CoordinateSystem(&Rx, &Ry);
+    *dir = around.Rotate(Rx, Ry, axis);
+    const float cos_theta = dir->dot(isect.sn);
+    if (cos_theta <= 0.f)
+        return false;
+
+    // throughput of the sample: f cos / pdf, or Ks / s_p for a mirror
+    *pdf = 0.f;
+    *delta = specular && f->isMirror();
+    if (*delta)
+        *weight = f->Ks / s_p;
+    else {
+        *pdf = f->pdf(*dir, isect.wo, isect.sn);
+        if (*pdf <= 0.f) return false;
+        *weight = f->f(*dir, isect.wo, isect.sn) * (cos_theta / *pdf);
+    }
+    return true;
+}
+
+// a BRDF sample from isect found light: its emission (lights only emit on
+// their front side), weighted against light sampling
+RGB PathTracerShader::emissionMIS(const Intersection &isect, const Intersection &light, float pdf, bool delta)
+{
+    if (((AreaLight *)scene->lights[light.light_ndx])->pdf(isect.p, light.p) <= 0.f)
+        return RGB();
+    if (delta)
+        return light.Le;
+    return light.Le * powerHeuristic(pdf, lightPdf(light.light_ndx, isect.p, isect.sn, light.p));
+}
+
+// Path tracing with multiple importance sampling of the direct light: each
+// vertex samples a light (directLightingMIS) and the BRDF (to continue the
+// path), and a BRDF sampled ray that hits a light adds its emission,
+// weighted against light sampling with the power heuristic. Unlike the
+// default estimator it uses the Phong BRDF and the geometry term of area
+// lights, so it converges to the physically based image; the lobe is picked
+// by luminance, as in shade, but weighted by the density of both lobes.
+RGB PathTracerShader::shadeMIS(const Intersection &isect, Phong *f, int depth, Sampler &sampler)
+{
+    RGB color(0., 0., 0.);
+    const bool hasSmooth = !f->Kd.isZero() || (!f->Ks.isZero() && !f->isMirror());
+
+    if (hasSmooth && scene->numLights > 0)
+        color += directLightingMIS(isect, f, sampler);
+
+    // russian roulette beyond MAX_DEPTH
+    float rr = 1.f;
+    if (depth >= MAX_DEPTH) {
+        if (sampler.get1D() >= continue_p)
+            return color;
+        rr = continue_p;
+    }
+
+    Vector dir;
+    RGB weight;
+    float pdf;
+    bool delta;
+    if (!sampleBRDF(isect, f, sampler, &dir, &weight, &pdf, &delta))
+        return color;
+    weight = weight / rr;
+
+    Ray r(isect.p, dir);
+    r.pix_x = isect.pix_x;
+    r.pix_y = isect.pix_y;
+    r.FaceID = isect.FaceID;
+    r.adjustOrigin(isect.gn);
+
+    Intersection next;
+    const bool intersected = scene->trace(r, &next);
+    if (!intersected)
+        color += weight * background;
+    else if (next.isLight)
+        color += weight * emissionMIS(isect, next, pdf, delta);
+    else
+        color += weight * shade(true, next, depth + 1, sampler);
+    return color;
+}
+
+bool PathTracerShader::setIterative(int maxDepth, int _rrDepth)
+{
+    if (!mis) {
+        fprintf(stderr, "PathTracerShader: the iterative integrator needs MIS, the shader stays recursive\n");
+        return false;
+    }
+    iterative = true;
+    maxPathDepth = maxDepth;
+    rrDepth = _rrDepth;
+    return true;
+}
+
+// The MIS estimator of shadeMIS as a loop: the path carries its throughput
+// (the product of the BRDF sample weights), so a vertex costs no call and
+// no copy of its Intersection, and paths are not limited by the stack.
+// Instead of the fixed continue_p beyond MAX_DEPTH, russian roulette after
+// rrDepth bounces continues with probability equal to the largest
+// component of the throughput (dividing by it): paths that carry little
+// light are cut early, bright ones go on. maxPathDepth bounds the bounces.
+RGB PathTracerShader::shadeIterative(const Intersection &first, Sampler &sampler)
+{
+    RGB color(0., 0., 0.), throughput(1., 1., 1.);
+    Intersection vertices[2];   // the vertex being shaded and the next one
+    const Intersection *isect = &first;
+
+    for (int depth = 0;; depth++) {
+        Phong *f = (Phong *)isect->f;
+        const bool hasSmooth = !f->Kd.isZero() || (!f->Ks.isZero() && !f->isMirror());
+        if (hasSmooth && scene->numLights > 0)
+            color += throughput * directLightingMIS(*isect, f, sampler);
+
+        if (depth >= maxPathDepth)
+            break;
+        if (depth >= rrDepth) {
+            const float q = throughput.maxComponent();
+            if (q < 1.f) {
+                if (sampler.get1D() >= q)
+                    break;
+                throughput = throughput / q;
+            }
+        }
+
+        Vector dir;
+        RGB weight;
+        float pdf;
+        bool delta;
+        if (!sampleBRDF(*isect, f, sampler, &dir, &weight, &pdf, &delta))
+            break;
+        throughput = throughput * weight;
+
+        Ray r(isect->p, dir);
+        r.pix_x = isect->pix_x;
+        r.pix_y = isect->pix_y;
+        r.FaceID = isect->FaceID;
+        r.adjustOrigin(isect->gn);
+
+        Intersection *next = &vertices[depth & 1];
+        if (!scene->trace(r, next)) {
+            color += throughput * background;
+            break;
+        }
+        if (next->isLight) {
+            color += throughput * emissionMIS(*isect, *next, pdf, delta);
+            break;
+        }
+        isect = next;
+    }
+    return color;
+}
@@ -13,14 +13,45 @@
 
 class PathTracerShader: public Shader {
     RGB background;
-    RGB directLighting (Intersection isect, Phong *f);
-    RGB specularReflection (Intersection isect, Phong *f, int depth);
-    RGB diffuseReflection (Intersection isect, Phong *f, int depth);
+    RGB directLighting (const Intersection &isect, Phong *f, Sampler &sampler);
+    RGB specularReflection (const Intersection &isect, Phong *f, int depth, Sampler &sampler);
+    RGB diffuseReflection (const Intersection &isect, Phong *f, int depth, Sampler &sampler);
     float continue_p;
     int MAX_DEPTH;
+    // multiple importance sampling (see shadeMIS)
+    bool mis;
+    RGB shadeMIS (const Intersection &isect, Phong *f, int depth, Sampler &sampler);
+    RGB directLightingMIS (const Intersection &isect, Phong *f, Sampler &sampler);
+    // solid angle density of light sampling choosing light l and point p
+    // from x, with shading normal n
+    float lightPdf (int l, const Point &x, const Vector &n, const Point &p);
+    // sample the direction of the next path segment from the BRDF (see shadeMIS)
+    bool sampleBRDF (const Intersection &isect, Phong *f, Sampler &sampler, Vector *dir, RGB *weight,
+                     float *pdf, bool *delta);
+    // emission of the light found by a BRDF sample from isect, weighted against light sampling
+    RGB emissionMIS (const Intersection &isect, const Intersection &light, float pdf, bool delta);
+    // iterative integrator (see shadeIterative)
+    bool iterative;
+    int maxPathDepth, rrDepth;
+    RGB shadeIterative (const Intersection &isect, Sampler &sampler);
 public:
-    PathTracerShader (Scene *scene, RGB bg): background(bg), Shader(scene) {continue_p = 0.5f; MAX_DEPTH=2;}
-    RGB shade (bool intersected, Intersection isect, int depth);
+    PathTracerShader (Scene *scene, RGB bg, bool _mis=false): background(bg), Shader(scene), mis(_mis),
+        iterative(false), maxPathDepth(64), rrDepth(3) {
+        continue_p = 0.5f; MAX_DEPTH=2;
+    }
+    // trace the paths of the MIS estimator with a loop that carries their
+    // throughput instead of recursing: at most maxDepth bounces, with
+    // russian roulette on the throughput after rrDepth. Requires a shader
+    // built with MIS on; the default estimator (MAX_DEPTH, continue_p) stays
+    // recursive, and false is returned without changing it
+    bool setIterative (int maxDepth=64, int _rrDepth=3);
+    RGB shade (bool intersected, const Intersection &isect, int depth, Sampler &sampler);
+    // parameters shared with the wavefront integrator
+    RGB getBackground () { return background; }
+    float getContinueProbability () { return continue_p; }
+    int getMaxDepth () { return MAX_DEPTH; }
+    bool getMIS () { return mis; }
+    bool getIterative () { return iterative; }
 };
 
 #endif /* DistributedShader_hpp */
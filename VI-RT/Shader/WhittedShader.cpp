@@ -9,7 +9,7 @@
 #include "Phong.hpp"
 #include "ray.hpp"
 
-RGB WhittedShader::directLighting(Intersection isect, Phong *f)
+RGB WhittedShader::directLighting(const Intersection &isect, Phong *f)
 {
     RGB color(0., 0., 0.);
 
@@ -55,7 +55,7 @@ RGB WhittedShader::directLighting(Intersection isect, Phong *f)
     return color;
 }
 
-RGB WhittedShader::specularReflection(Intersection isect, Phong *f, int depth)
+RGB WhittedShader::specularReflection(const Intersection &isect, Phong *f, int depth, Sampler &sampler)
 {
     // generate the specular ray
     float cos = isect.gn.dot(isect.wo);
@@ -66,11 +66,11 @@ RGB WhittedShader::specularReflection(Intersection isect, Phong *f, int depth)
     // trace ray
     bool intersected = scene->trace(specular, &s_isect);
     // shade this intersection
-    RGB color = shade(intersected, s_isect, depth + 1);
+    RGB color = shade(intersected, s_isect, depth + 1, sampler);
     return color;
 }
 
-RGB WhittedShader::shade(bool intersected, Intersection isect, int depth)
+RGB WhittedShader::shade(bool intersected, const Intersection &isect, int depth, Sampler &sampler)
 {
     RGB color(0., 0., 0.);
 
@@ -91,7 +91,7 @@ RGB WhittedShader::shade(bool intersected, Intersection isect, int depth)
     // if there is a specular component sample it
     if (!f->Ks.isZero() && depth < 3)
     {
-        color += specularReflection(isect, f, depth + 1);
+        color += specularReflection(isect, f, depth + 1, sampler);
     }
 
     color += directLighting(isect, f);
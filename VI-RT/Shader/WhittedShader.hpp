@@ -13,11 +13,11 @@
 
 class WhittedShader: public Shader {
     RGB background;
-    RGB directLighting (Intersection isect, Phong *f);
-    RGB specularReflection (Intersection isect, Phong *f, int depth);
+    RGB directLighting (const Intersection &isect, Phong *f);
+    RGB specularReflection (const Intersection &isect, Phong *f, int depth, Sampler &sampler);
 public:
     WhittedShader (Scene *scene, RGB bg): background(bg), Shader(scene) {}
-    RGB shade (bool intersected, Intersection isect, int depth);
+    RGB shade (bool intersected, const Intersection &isect, int depth, Sampler &sampler);
 };
 
 #endif /* AmbientShader_hpp */
@@ -10,6 +10,7 @@
 
 #include "scene.hpp"
 #include "RGB.hpp"
+#include "sampler.hpp"
 
 class Shader {
 protected:
@@ -17,7 +18,8 @@ protected:
 public:
     Shader (Scene *_scene): scene(_scene) {}
     ~Shader () {}
-    virtual RGB shade (bool intersected, Intersection isect, int depth) {
+    // all random numbers needed to shade this sample are drawn from sampler
+    virtual RGB shade (bool intersected, const Intersection &isect, int depth, Sampler &sampler) {
         return RGB();
     }
 };
@@ -10,6 +10,7 @@
 #include "perspective.hpp"
 #include "StandardRenderer.hpp"
 #include "WindowRenderer.hpp"
+#include "WavefrontRenderer.hpp"
 #include "ImagePPM.hpp"
 #include "AmbientShader.hpp"
 #include "WhittedShader.hpp"
@@ -20,6 +21,7 @@
 #include "AreaLight.hpp"
 
 #include <time.h>
+#include <chrono>
 #include "mesh.hpp"
 
 int main(int argc, const char *argv[])
@@ -29,7 +31,6 @@ int main(int argc, const char *argv[])
     ImagePPM *img;    // Image
     Shader *shd;
     bool success;
-    clock_t start, end;
     double cpu_time_used;
 
     // success = scene.Load("VI-RT/Scene/tinyobjloader/models/cornell_box_VI.obj");
@@ -95,6 +96,12 @@ int main(int argc, const char *argv[])
         }
     }
 
+    // build the acceleration structure once all the lights are in the scene
+    scene.BuildAccelStruct();
+    // shaders pick the light to sample with the light BVH, by its estimated
+    // contribution; only by power (or uniformly) with
+    // scene.SetLightSampling(LIGHTS_POWER);
+
     scene.printSummary();
     std::cout << std::endl;
     // scene.printScene();
@@ -122,22 +129,36 @@ int main(int argc, const char *argv[])
     // shd = new WhittedShader(&scene, background);
     // shd = new DistributedShader(&scene, background);
     shd = new PathTracerShader(&scene, background);
+    // multiple importance sampling of the direct light (physically based: area
+    // lights fall off with distance, so they need more power)
+    // shd = new PathTracerShader(&scene, background, true);
+    // the MIS estimator as a loop over the bounces (at most 64, russian
+    // roulette on the path throughput after 3); needs the MIS shader above
+    // ((PathTracerShader *)shd)->setIterative(64, 3);
     // declare the renderer
     int spp = 16; // samples per pixel
 
     WindowRenderer myRender(cam, &scene, img, shd, spp);
+    // tiled render on a work stealing thread pool: 0 threads = one per core, 16x16 tiles
+    // StandardRenderer myRender(cam, &scene, img, shd, spp, 0, 16);
+    // adaptive: spp on average, more where a pixel is still noisier than 10%
+    // myRender.setAdaptive(0.1f);
+    // wavefront path tracer (bounce by bounce over 16x16 tiles), same image in expectation
+    // WavefrontRenderer myRender(cam, &scene, img, (PathTracerShader *)shd, spp, 0, 16);
 
         if (dynamic_cast<WindowRenderer*>(&myRender)) 
             spp = ((WindowRenderer*)&myRender)->spp;
     
     // render
     
-    start = clock();
+    // wall clock time: clock() adds up the CPU time of all render threads
+    auto render_start = std::chrono::steady_clock::now();
     myRender.Render();
-    end = clock();
-    cpu_time_used = ((double)(end - start)) / CLOCKS_PER_SEC;
+    cpu_time_used = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
     
-    fprintf(stdout, "Rendering time = %.3lf secs\n\n", cpu_time_used);
+    fprintf(stdout, "Rendering time = %.3lf secs\n", cpu_time_used);
+    scene.printAccelStats();
+    std::cout << std::endl;
 
     char name[64];
 
@@ -145,6 +166,8 @@ int main(int argc, const char *argv[])
 
     // save the image
     img->Save(name);
+    // where the adaptive StandardRenderer took its samples
+    // myRender.SaveSampleMap("MySamples.ppm");
 
 
 
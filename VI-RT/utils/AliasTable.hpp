@@ -0,0 +1,70 @@
+//
+//  AliasTable.hpp
+//  VI-RT
+//
+
+#ifndef AliasTable_hpp
+#define AliasTable_hpp
+
+#include <vector>
+
+// Discrete distribution over n items with probabilities proportional to
+// a set of weights, sampled in O(1) with Walker's alias method (Vose's
+// construction, see pbrt book (4th ed.), sec A.1).
+// Each of the n equal slots keeps its own item with probability prob[i]
+// and gives the rest of the slot to item alias[i].
+class AliasTable {
+    std::vector<float> prob;     // chance of keeping the slot's own item
+    std::vector<int> alias;
+    std::vector<float> p;        // probability of each item
+public:
+    // non-positive weights are never sampled; if all are, the distribution is uniform
+    void build (const std::vector<float> &weights) {
+        const int n = (int)weights.size();
+        prob.assign(n, 1.f);
+        alias.resize(n);
+        p.assign(n, 0.f);
+        double sum = 0.;
+        for (float w : weights)
+            if (w > 0.f) sum += w;
+
+        std::vector<double> scaled(n);   // probability * n, 1 is a full slot
+        for (int i=0 ; i<n ; i++) {
+            scaled[i] = (sum > 0.) ? ((weights[i] > 0.f) ? weights[i] * n / sum : 0.) : 1.;
+            p[i] = (float)(scaled[i] / n);
+            alias[i] = i;
+        }
+
+        std::vector<int> small, large;
+        for (int i=0 ; i<n ; i++)
+            (scaled[i] < 1.) ? small.push_back(i) : large.push_back(i);
+        while (!small.empty() && !large.empty()) {
+            const int s = small.back(), l = large.back();
+            small.pop_back();
+            large.pop_back();
+            prob[s] = (float)scaled[s];
+            alias[s] = l;
+            // l fills the rest of slot s
+            scaled[l] -= 1. - scaled[s];
+            (scaled[l] < 1.) ? small.push_back(l) : large.push_back(l);
+        }
+        // what is left is a full slot, up to rounding errors
+        for (int i : small) prob[i] = 1.f;
+        for (int i : large) prob[i] = 1.f;
+    }
+    int size () const { return (int)p.size(); }
+    // item for a uniform u in [0,1[ (a single number picks the slot and
+    // decides between the slot's item and its alias), and its probability
+    int sample (float u, float *pdf) const {
+        const int n = (int)p.size();
+        const float un = u * n;
+        int i = (int)un;
+        if (i >= n) i = n-1;
+        if (un - i >= prob[i]) i = alias[i];
+        *pdf = p[i];
+        return i;
+    }
+    float pdf (int i) const { return p[i]; }
+};
+
+#endif /* AliasTable_hpp */
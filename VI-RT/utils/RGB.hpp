@@ -8,6 +8,8 @@
 #ifndef RGB_hpp
 #define RGB_hpp
 
+#include <algorithm>
+
 class RGB {
 public:
     float R, G, B;
@@ -22,7 +24,7 @@ public:
         this->B += rhs.B;
         return *this;
     }
-    RGB operator+(RGB const& obj)
+    RGB operator+(RGB const& obj) const
     {
         RGB res;
         res.R = R + obj.R;
@@ -30,7 +32,7 @@ public:
         res.B = B + obj.B;
         return res;
     }
-    RGB operator-(RGB const& obj)
+    RGB operator-(RGB const& obj) const
     {
         RGB res;
         res.R = R - obj.R;
@@ -38,7 +40,7 @@ public:
         res.B = B - obj.B;
         return res;
     }
-    RGB operator*(RGB const& obj)
+    RGB operator*(RGB const& obj) const
     {
         RGB res;
         res.R = R * obj.R;
@@ -46,7 +48,7 @@ public:
         res.B = B * obj.B;
         return res;
     }
-    RGB operator*(float const& f)
+    RGB operator*(float const& f) const
     {
         RGB res;
         res.R = R * f;
@@ -54,14 +56,14 @@ public:
         res.B = B * f;
         return res;
     }
-    RGB operator/(float const& f)
+    RGB operator/(float const& f) const
     {
         RGB res;
         res.R = R / f;
         res.G = G / f;
         res.B = B / f;
         return res;
-    }RGB operator/(RGB const& c)
+    }RGB operator/(RGB const& c) const
     {
         RGB res;
         res.R = R / c.R;
@@ -69,10 +71,13 @@ public:
         res.B = B / c.B;
         return res;
     }
-    float Y() {
+    float Y() const {
         return (R*0.2126 + G*0.7152 + B*0.0722 );
     }
-    bool isZero () {
+    float maxComponent() const {
+        return std::max(R, std::max(G, B));
+    }
+    bool isZero () const {
         return ((R==0.) && (G==0.) && (B==0.));
     }
 };
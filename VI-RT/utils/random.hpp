@@ -0,0 +1,39 @@
+//
+//  random.hpp
+//  VI-RT
+//
+
+#ifndef random_hpp
+#define random_hpp
+
+#include <stdint.h>
+
+// PCG32 random number generator (M. O'Neill, https://www.pcg-random.org)
+// 64 bits of state, independent streams selected by the sequence number
+class PCG32 {
+    uint64_t state, inc;
+public:
+    PCG32 () { setSeed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+    PCG32 (uint64_t seed, uint64_t seq) { setSeed(seed, seq); }
+    void setSeed (uint64_t seed, uint64_t seq) {
+        state = 0u;
+        inc = (seq << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+    uint32_t next () {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+    // uniformly distributed float in [0,1[
+    float uniform () {
+        // use the upper 24 bits so that the result is exactly representable
+        return (float)(next() >> 8) * (1.f / 16777216.f);
+    }
+};
+
+#endif /* random_hpp */
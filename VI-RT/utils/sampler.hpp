@@ -0,0 +1,45 @@
+//
+//  sampler.hpp
+//  VI-RT
+//
+
+#ifndef sampler_hpp
+#define sampler_hpp
+
+#include <stdint.h>
+#include "random.hpp"
+
+// Source of the random numbers used while computing one sample.
+// Each (pixel, sample index) pair gets its own PCG32 stream, so a render
+// is reproducible for a fixed seed and does not depend on which thread
+// computed which sample. Samplers are not shared between threads.
+class Sampler {
+    PCG32 rng;
+    uint64_t seed;
+    // splitmix64 finalizer, decorrelates consecutive sample indices
+    static uint64_t mix (uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+public:
+    Sampler (uint64_t _seed=0): seed(_seed) { startPixelSample(0, 0, 0); }
+    // restart the stream for sample ss of pixel (x,y)
+    void startPixelSample (int x, int y, int ss) {
+        rng.setSeed(mix(seed + (uint64_t)ss), ((uint64_t)y << 32) | (uint32_t)x);
+    }
+    // uniform float in [0,1[
+    float get1D () { return rng.uniform(); }
+    // pair of uniform floats in [0,1[
+    void get2D (float *r) {
+        r[0] = rng.uniform();
+        r[1] = rng.uniform();
+    }
+    // uniform integer in [0,n[
+    int getIndex (int n) {
+        int i = (int)(rng.uniform() * n);
+        return (i < n) ? i : n-1;
+    }
+};
+
+#endif /* sampler_hpp */
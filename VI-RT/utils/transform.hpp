@@ -0,0 +1,90 @@
+//
+//  transform.hpp
+//  VI-RT
+//
+
+#ifndef transform_hpp
+#define transform_hpp
+
+#include <cmath>
+#include "vector.hpp"
+
+// Affine transform: a 3x3 linear part and a translation (last column),
+// see pbrt book (3rd ed.), sec 2.7
+class Transform {
+public:
+    float m[3][4];
+
+    Transform () {   // identity
+        for (int i=0 ; i<3 ; i++)
+            for (int j=0 ; j<4 ; j++)
+                m[i][j] = (i == j) ? 1.f : 0.f;
+    }
+    static Transform translate (const Vector &t) {
+        Transform T;
+        T.m[0][3] = t.X; T.m[1][3] = t.Y; T.m[2][3] = t.Z;
+        return T;
+    }
+    static Transform scale (float x, float y, float z) {
+        Transform T;
+        T.m[0][0] = x; T.m[1][1] = y; T.m[2][2] = z;
+        return T;
+    }
+    // rotation around the Y (up) axis, angle in radians
+    static Transform rotateY (float angle) {
+        Transform T;
+        const float c = cosf(angle), s = sinf(angle);
+        T.m[0][0] = c;  T.m[0][2] = s;
+        T.m[2][0] = -s; T.m[2][2] = c;
+        return T;
+    }
+    // this after t
+    Transform operator* (const Transform &t) const {
+        Transform R;
+        for (int i=0 ; i<3 ; i++) {
+            for (int j=0 ; j<4 ; j++) {
+                R.m[i][j] = m[i][0] * t.m[0][j] + m[i][1] * t.m[1][j] + m[i][2] * t.m[2][j];
+                if (j == 3) R.m[i][j] += m[i][3];
+            }
+        }
+        return R;
+    }
+    Transform inverse () const {
+        // inverse of the linear part by cofactors, then of the translation
+        const float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                        - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                        + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        const float id = 1.f / det;
+        Transform I;
+        I.m[0][0] =  (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * id;
+        I.m[0][1] = -(m[0][1] * m[2][2] - m[0][2] * m[2][1]) * id;
+        I.m[0][2] =  (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * id;
+        I.m[1][0] = -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) * id;
+        I.m[1][1] =  (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * id;
+        I.m[1][2] = -(m[0][0] * m[1][2] - m[0][2] * m[1][0]) * id;
+        I.m[2][0] =  (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * id;
+        I.m[2][1] = -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) * id;
+        I.m[2][2] =  (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * id;
+        for (int i=0 ; i<3 ; i++)
+            I.m[i][3] = -(I.m[i][0] * m[0][3] + I.m[i][1] * m[1][3] + I.m[i][2] * m[2][3]);
+        return I;
+    }
+    Point point (const Point &p) const {
+        return Point(m[0][0] * p.X + m[0][1] * p.Y + m[0][2] * p.Z + m[0][3],
+                     m[1][0] * p.X + m[1][1] * p.Y + m[1][2] * p.Z + m[1][3],
+                     m[2][0] * p.X + m[2][1] * p.Y + m[2][2] * p.Z + m[2][3]);
+    }
+    Vector vector (const Vector &v) const {
+        return Vector(m[0][0] * v.X + m[0][1] * v.Y + m[0][2] * v.Z,
+                      m[1][0] * v.X + m[1][1] * v.Y + m[1][2] * v.Z,
+                      m[2][0] * v.X + m[2][1] * v.Y + m[2][2] * v.Z);
+    }
+    // normals transform by the inverse transpose: pass the inverse transform
+    static Vector normal (const Transform &inv, const Vector &n) {
+        return Vector(inv.m[0][0] * n.X + inv.m[1][0] * n.Y + inv.m[2][0] * n.Z,
+                      inv.m[0][1] * n.X + inv.m[1][1] * n.Y + inv.m[2][1] * n.Z,
+                      inv.m[0][2] * n.X + inv.m[1][2] * n.Y + inv.m[2][2] * n.Z);
+    }
+};
+
+#endif /* transform_hpp */
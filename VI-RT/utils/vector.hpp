@@ -33,7 +33,7 @@ public:
         return p*f;
     }
     // note that methods declared within the class are inline by default
-    inline float norm () {
+    inline float norm () const {
         return sqrtf(X*X+Y*Y+Z*Z);
     }
     inline void normalize () {
@@ -44,11 +44,11 @@ public:
             Z /= my_norm;
         }
     }
-    float dot (const Vector v2) const {
+    float dot (const Vector &v2) const {
         return X*v2.X + Y*v2.Y + Z*v2.Z;
     }
     // from pbrt book (3rd ed.), sec 2.2.1, pag 65
-    Vector cross (Vector v2) const {
+    Vector cross (const Vector &v2) const {
         double v1x = X, v1y = Y, v1z = Z;
         double v2x = v2.X, v2y = v2.Y, v2z = v2.Z;
         return Vector((v1y * v2z) - (v1z * v2y),
@@ -56,15 +56,15 @@ public:
                         (v1x * v2y) - (v1y * v2x));
     }
     // from pbrt book (3rd ed.), sec 2.2.1, pag 63
-    Vector Abs(void) {
+    Vector Abs(void) const {
         return Vector(std::abs(X), std::abs(Y), std::abs(Z));
     }
     // from pbrt book (3rd ed.), sec 2.2.1, pag 66
-    int MaxDimension(void) {
+    int MaxDimension(void) const {
         return (X > Y) ? ((X > Z) ? 0 : 2) : ((Y > Z) ? 1 : 2);
     }
     // from pbrt book (3rd ed.), sec 2.2.1, pag 67
-    Vector Permute(int x, int y, int z) {
+    Vector Permute(int x, int y, int z) const {
         const float XYZ[3]={X,Y,Z};
         return Vector(XYZ[x], XYZ[y], XYZ[z]);
     }
@@ -76,7 +76,7 @@ public:
     }
     // Generate an orthonormal coordinate system around this vector (must be normalized)
     // returns the 2 new axis orthogonal top the vector
-    void CoordinateSystem(Vector *v2, Vector *v3) {
+    void CoordinateSystem(Vector *v2, Vector *v3) const {
         if (abs(X) > abs(Y))
             *v2 = Vector(-Z, 0, X) / sqrtf(X * X + Z * Z);
         else
@@ -86,7 +86,7 @@ public:
 
     // returns a new vector, which is this vector rotated to the
     // reference system defined by Rx, Ry, Rz
-    Vector Rotate (Vector Rx, Vector Ry, Vector Rz) {
+    Vector Rotate (const Vector &Rx, const Vector &Ry, const Vector &Rz) const {
         Vector vec;
         
         vec.X = X * Rx.X + Y * Ry.X + Z * Rz.X;
@@ -120,11 +120,11 @@ public:
         X=x;Y=y;Z=z;
     }
     // note that methods declared within the class are inline by default
-    inline Vector vec2point (Point p2) {
+    inline Vector vec2point (const Point &p2) const {
         Vector v(p2.X-X, p2.Y-Y, p2.Z-Z);
         return v;
     }
-    Point Permute(int x, int y, int z) {
+    Point Permute(int x, int y, int z) const {
         const float XYZ[3]={X,Y,Z};
         return Point(XYZ[x], XYZ[y], XYZ[z]);
     }